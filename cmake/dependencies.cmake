@@ -106,7 +106,7 @@ if (NOT OGLTUTOR_SYSTEM_GLAD)
   )
 
   set(GLAD_PROFILE "core" CACHE INTERNAL "OpenGL profile" FORCE)
-  set(GLAD_API "gl=3.3" CACHE INTERNAL "API type/version pairs, like \"gl=3.2,gles=\", no version means latest" FORCE)
+  set(GLAD_API "gl=4.3" CACHE INTERNAL "API type/version pairs, like \"gl=3.2,gles=\", no version means latest" FORCE)
   set(GLAD_GENERATOR "c" CACHE INTERNAL "Language to generate the binding for" FORCE)
   set(GLAD_EXTENSIONS "" CACHE INTERNAL "Path to extensions file or comma separated list of extensions, if missing all extensions are included" FORCE)
   set(GLAD_SPEC "gl" CACHE INTERNAL "Name of the spec" FORCE)
@@ -0,0 +1,48 @@
+#version 400
+
+layout(location = 0) out vec3 VelocityOut;
+layout(location = 1) out float TemperatureOut;
+layout(location = 2) out float DensityOut;
+
+uniform sampler3D VelocityTexture;
+uniform sampler3D TemperatureTexture;
+uniform sampler3D DensityTexture;
+uniform usampler3D Obstacles;
+
+uniform vec3 InverseSize;
+uniform float TimeStep;
+uniform vec3 Dissipation;
+
+in float gLayer;
+
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
+// Backtraces once and carries velocity, temperature and density along the
+// same path. Dissipation holds the factor for each of them in that order.
+
+void main()
+{
+    vec3 fragCoord = vec3(gl_FragCoord.xy, gLayer);
+    if (!Active(ivec3(fragCoord), textureSize(Obstacles, 0))) {
+        VelocityOut = vec3(0);
+        TemperatureOut = 0;
+        DensityOut = 0;
+        return;
+    }
+
+    uint flags = texelFetch(Obstacles, ivec3(fragCoord), 0).x;
+    if ((flags & Solid) != 0u) {
+        VelocityOut = vec3(0);
+        TemperatureOut = 0;
+        DensityOut = 0;
+        return;
+    }
+
+    vec3 u = texture(VelocityTexture, InverseSize * fragCoord).xyz;
+
+    vec3 coord = InverseSize * (fragCoord - TimeStep * u);
+    VelocityOut = Dissipation.x * texture(VelocityTexture, coord).xyz;
+    TemperatureOut = Dissipation.y * texture(TemperatureTexture, coord).x;
+    DensityOut = Dissipation.z * texture(DensityTexture, coord).x;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#version 400
+
+out vec4 FragColor;
+
+uniform sampler3D VelocityTexture;
+uniform sampler3D SourceTexture;
+uniform sampler3D ForwardTexture;
+uniform sampler3D BackwardTexture;
+uniform usampler3D Obstacles;
+
+uniform vec3 InverseSize;
+uniform float TimeStep;
+uniform float Dissipation;
+
+in float gLayer;
+
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
+// ForwardTexture holds the plain semi-Lagrangian result and BackwardTexture
+// that result traced back again. Half of the round trip's error is added back,
+// then clamped to the eight source texels the forward step blended between so
+// the correction can't overshoot into new extrema.
+
+void main()
+{
+    vec3 fragCoord = vec3(gl_FragCoord.xy, gLayer);
+    ivec3 T = ivec3(fragCoord);
+    ivec3 size = textureSize(Obstacles, 0);
+    if (!Active(T, size)) {
+        FragColor = vec4(0);
+        return;
+    }
+
+    uint flags = texelFetch(Obstacles, ivec3(fragCoord), 0).x;
+    if ((flags & Solid) != 0u) {
+        FragColor = vec4(0);
+        return;
+    }
+
+    vec3 u = texture(VelocityTexture, InverseSize * fragCoord).xyz;
+    ivec3 base = ivec3(floor(fragCoord - TimeStep * u - 0.5));
+
+    vec4 lo = vec4(1e30);
+    vec4 hi = vec4(-1e30);
+    for (int i = 0; i < 8; ++i) {
+        ivec3 C = clamp(base + ivec3(i & 1, (i >> 1) & 1, i >> 2), ivec3(0), size - 1);
+        vec4 s = texelFetch(SourceTexture, C, 0);
+        lo = min(lo, s);
+        hi = max(hi, s);
+    }
+
+    vec4 forward = texelFetch(ForwardTexture, T, 0);
+    vec4 backward = texelFetch(BackwardTexture, T, 0);
+    vec4 source = texelFetch(SourceTexture, T, 0);
+
+    vec4 corrected = forward + 0.5 * (source - backward);
+    FragColor = Dissipation * clamp(corrected, lo, hi);
+}
\ No newline at end of file
@@ -4,7 +4,7 @@ out vec4 FragColor;
 
 uniform sampler3D VelocityTexture;
 uniform sampler3D SourceTexture;
-uniform sampler3D Obstacles;
+uniform usampler3D Obstacles;
 
 uniform vec3 InverseSize;
 uniform float TimeStep;
@@ -12,11 +12,19 @@ uniform float Dissipation;
 
 in float gLayer;
 
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
 void main()
 {
     vec3 fragCoord = vec3(gl_FragCoord.xy, gLayer);
-    float solid = texture(Obstacles, InverseSize * fragCoord).x;
-    if (solid > 0) {
+    if (!Active(ivec3(fragCoord), textureSize(Obstacles, 0))) {
+        FragColor = vec4(0);
+        return;
+    }
+
+    uint flags = texelFetch(Obstacles, ivec3(fragCoord), 0).x;
+    if ((flags & Solid) != 0u) {
         FragColor = vec4(0);
         return;
     }
@@ -0,0 +1,47 @@
+#version 400
+
+out float FragColor;
+
+uniform sampler3D Density;
+uniform sampler3D Temperature;
+uniform sampler3D Velocity;
+uniform sampler3D ObstacleVelocity;
+uniform float AmbientTemperature;
+uniform float Threshold;
+
+in float gLayer;
+
+const int BrickSize = 8;
+
+// Flags a brick as active when any of its voxels carries density, heat that
+// buoyancy will turn into motion, motion of its own or a moving obstacle.
+// Velocities are looked up by position since they may live on a coarser grid.
+
+bool Occupied(ivec3 T)
+{
+    float d = texelFetch(Density, T, 0).x;
+    float t = texelFetch(Temperature, T, 0).x - AmbientTemperature;
+    vec3 p = (vec3(T) + 0.5) / vec3(textureSize(Density, 0));
+    vec3 v = texture(Velocity, p).xyz;
+    vec3 o = texture(ObstacleVelocity, p).xyz;
+    return d > Threshold || abs(t) > Threshold || max(dot(v, v), dot(o, o)) > Threshold * Threshold;
+}
+
+void main()
+{
+    ivec3 origin = ivec3(gl_FragCoord.xy, gLayer) * BrickSize;
+    ivec3 last = min(origin + BrickSize, textureSize(Density, 0)) - 1;
+
+    for (int z = origin.z; z <= last.z; ++z) {
+        for (int y = origin.y; y <= last.y; ++y) {
+            for (int x = origin.x; x <= last.x; ++x) {
+                if (Occupied(ivec3(x, y, z))) {
+                    FragColor = 1;
+                    return;
+                }
+            }
+        }
+    }
+
+    FragColor = 0;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 400
+
+out float FragColor;
+
+uniform sampler3D Activity;
+
+in float gLayer;
+
+// Grows the active region by one brick so that anything advected or pushed
+// across a brick boundary this step still lands in an active brick.
+
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 last = textureSize(Activity, 0) - 1;
+
+    float active = 0;
+    for (int z = -1; z <= 1; ++z) {
+        for (int y = -1; y <= 1; ++y) {
+            for (int x = -1; x <= 1; ++x) {
+                ivec3 N = clamp(T + ivec3(x, y, z), ivec3(0), last);
+                active = max(active, texelFetch(Activity, N, 0).x);
+            }
+        }
+    }
+
+    FragColor = active;
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+uniform sampler3D BrickMask;
+
+// Voxels outside the active bricks are treated as empty and skip the work.
+bool Active(ivec3 T, ivec3 size)
+{
+    return texelFetch(BrickMask, T * textureSize(BrickMask, 0) / size, 0).x > 0;
+}
\ No newline at end of file
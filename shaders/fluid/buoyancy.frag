@@ -9,18 +9,33 @@ uniform float TimeStep;
 uniform float Sigma;
 uniform float Kappa;
 
+// Velocity cells per temperature cell. Velocity is measured in cells of its
+// own grid, so the same force is fewer cells per second on a coarser one.
+uniform float VelocityScale = 1.0;
+
 in float gLayer;
 
+#include "brick-mask.glsl"
+
 void main()
 {
     ivec3 TC = ivec3(gl_FragCoord.xy, gLayer);
-    float T = texelFetch(Temperature, TC, 0).r;
+    if (!Active(TC, textureSize(Velocity, 0))) {
+        FragColor = vec3(0);
+        return;
+    }
+
+    // Temperature and density may be finer than velocity. At half resolution a
+    // coarse voxel's centre is the shared corner of the eight fine voxels it
+    // covers, so linear filtering there is exactly their average.
+    vec3 coord = (vec3(TC) + 0.5) / vec3(textureSize(Velocity, 0));
+    float T = texture(Temperature, coord).r;
     vec3 V = texelFetch(Velocity, TC, 0).xyz;
 
     FragColor = V;
 
     if (T > AmbientTemperature) {
-        float D = texelFetch(Density, TC, 0).x;
-        FragColor += (TimeStep * (T - AmbientTemperature) * Sigma - D * Kappa ) * vec3(0, -1, 0);
+        float D = texture(Density, coord).x;
+        FragColor += VelocityScale * (TimeStep * (T - AmbientTemperature) * Sigma - D * Kappa ) * vec3(0, -1, 0);
     }
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#version 400
+
+out vec3 FragColor;
+
+uniform sampler3D Velocity;
+uniform sampler3D Vorticity;
+uniform usampler3D Obstacles;
+uniform float HalfInverseCellSize;
+uniform float CellSize;
+uniform float TimeStep;
+uniform float Epsilon;
+
+in float gLayer;
+
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    if (!Active(T, textureSize(Obstacles, 0))) {
+        FragColor = vec3(0);
+        return;
+    }
+
+    vec3 V = texelFetch(Velocity, T, 0).xyz;
+    if ((texelFetch(Obstacles, T, 0).x & Solid) != 0u) {
+        FragColor = V;
+        return;
+    }
+
+    // Gradient of the vorticity magnitude points towards the centre of each swirl
+    float wN = length(texelFetchOffset(Vorticity, T, 0, ivec3(0, 1, 0)).xyz);
+    float wS = length(texelFetchOffset(Vorticity, T, 0, ivec3(0, -1, 0)).xyz);
+    float wE = length(texelFetchOffset(Vorticity, T, 0, ivec3(1, 0, 0)).xyz);
+    float wW = length(texelFetchOffset(Vorticity, T, 0, ivec3(-1, 0, 0)).xyz);
+    float wU = length(texelFetchOffset(Vorticity, T, 0, ivec3(0, 0, 1)).xyz);
+    float wD = length(texelFetchOffset(Vorticity, T, 0, ivec3(0, 0, -1)).xyz);
+
+    vec3 eta = HalfInverseCellSize * vec3(wE - wW, wN - wS, wU - wD);
+    vec3 N = eta / (length(eta) + 1e-5);
+    vec3 omega = texelFetch(Vorticity, T, 0).xyz;
+
+    // Pushing along N x omega spins each swirl back up by what advection smeared out
+    vec3 force = Epsilon * CellSize * cross(N, omega);
+
+    FragColor = V + TimeStep * force;
+}
\ No newline at end of file
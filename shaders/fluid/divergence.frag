@@ -3,14 +3,23 @@
 out float FragColor;
 
 uniform sampler3D Velocity;
-uniform sampler3D Obstacles;
+uniform usampler3D Obstacles;
 uniform float HalfInverseCellSize;
 
 in float gLayer;
 
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+#include "obstacle-velocity.glsl"
+
 void main()
 {
     ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 size = textureSize(Obstacles, 0);
+    if (!Active(T, size)) {
+        FragColor = 0;
+        return;
+    }
 
     // Find neighboring velocities:
     vec3 vN = texelFetchOffset(Velocity, T, 0, ivec3(0, 1, 0)).xyz;
@@ -20,21 +29,16 @@ void main()
     vec3 vU = texelFetchOffset(Velocity, T, 0, ivec3(0, 0, 1)).xyz;
     vec3 vD = texelFetchOffset(Velocity, T, 0, ivec3(0, 0, -1)).xyz;
 
-    // Find neighboring obstacles:
-    vec3 oN = texelFetchOffset(Obstacles, T, 0, ivec3(0, 1, 0)).xyz;
-    vec3 oS = texelFetchOffset(Obstacles, T, 0, ivec3(0, -1, 0)).xyz;
-    vec3 oE = texelFetchOffset(Obstacles, T, 0, ivec3(1, 0, 0)).xyz;
-    vec3 oW = texelFetchOffset(Obstacles, T, 0, ivec3(-1, 0, 0)).xyz;
-    vec3 oU = texelFetchOffset(Obstacles, T, 0, ivec3(0, 0, 1)).xyz;
-    vec3 oD = texelFetchOffset(Obstacles, T, 0, ivec3(0, 0, -1)).xyz;
-
-    // Use obstacle velocities for solid cells:
-    if (oN.x > 0) vN = oN.yzx;
-    if (oS.x > 0) vS = oS.yzx;
-    if (oE.x > 0) vE = oE.yzx;
-    if (oW.x > 0) vW = oW.yzx;
-    if (oU.x > 0) vU = oU.yzx;
-    if (oD.x > 0) vD = oD.yzx;
+    // One fetch says which neighbours are solid:
+    uint flags = texelFetch(Obstacles, T, 0).x;
+
+    // Solid cells contribute their obstacle's velocity, which is zero for the walls:
+    if ((flags & SolidN) != 0u) vN = ObstacleVelocityAt(T + ivec3(0, 1, 0), size);
+    if ((flags & SolidS) != 0u) vS = ObstacleVelocityAt(T + ivec3(0, -1, 0), size);
+    if ((flags & SolidE) != 0u) vE = ObstacleVelocityAt(T + ivec3(1, 0, 0), size);
+    if ((flags & SolidW) != 0u) vW = ObstacleVelocityAt(T + ivec3(-1, 0, 0), size);
+    if ((flags & SolidU) != 0u) vU = ObstacleVelocityAt(T + ivec3(0, 0, 1), size);
+    if ((flags & SolidD) != 0u) vD = ObstacleVelocityAt(T + ivec3(0, 0, -1), size);
 
     FragColor = HalfInverseCellSize * (vE.x - vW.x + vN.y - vS.y + vU.z - vD.z);
 }
\ No newline at end of file
@@ -4,16 +4,28 @@ out vec4 FragColor;
 
 uniform sampler3D Pressure;
 uniform sampler3D Divergence;
-uniform sampler3D Obstacles;
+uniform usampler3D Obstacles;
 
 uniform float Alpha;
 uniform float InverseBeta;
+uniform float Omega;
 
 in float gLayer;
 
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
 void main()
 {
     ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    vec4 pC = texelFetch(Pressure, T, 0);
+
+    // Inactive bricks keep the pressure they had. The sparse solve starts
+    // from last step's pressure, so that is the last value solved there.
+    if (!Active(T, textureSize(Obstacles, 0))) {
+        FragColor = pC;
+        return;
+    }
 
     // Find neighboring pressure:
     vec4 pN = texelFetchOffset(Pressure, T, 0, ivec3(0, 1, 0));
@@ -22,24 +34,21 @@ void main()
     vec4 pW = texelFetchOffset(Pressure, T, 0, ivec3(-1, 0, 0));
     vec4 pU = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, 1));
     vec4 pD = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, -1));
-    vec4 pC = texelFetch(Pressure, T, 0);
 
-    // Find neighboring obstacles:
-    vec3 oN = texelFetchOffset(Obstacles, T, 0, ivec3(0, 1, 0)).xyz;
-    vec3 oS = texelFetchOffset(Obstacles, T, 0, ivec3(0, -1, 0)).xyz;
-    vec3 oE = texelFetchOffset(Obstacles, T, 0, ivec3(1, 0, 0)).xyz;
-    vec3 oW = texelFetchOffset(Obstacles, T, 0, ivec3(-1, 0, 0)).xyz;
-    vec3 oU = texelFetchOffset(Obstacles, T, 0, ivec3(0, 0, 1)).xyz;
-    vec3 oD = texelFetchOffset(Obstacles, T, 0, ivec3(0, 0, -1)).xyz;
+    // One fetch says which neighbours are solid:
+    uint flags = texelFetch(Obstacles, T, 0).x;
 
     // Use center pressure for solid cells:
-    if (oN.x > 0) pN = pC;
-    if (oS.x > 0) pS = pC;
-    if (oE.x > 0) pE = pC;
-    if (oW.x > 0) pW = pC;
-    if (oU.x > 0) pU = pC;
-    if (oD.x > 0) pD = pC;
+    if ((flags & SolidN) != 0u) pN = pC;
+    if ((flags & SolidS) != 0u) pS = pC;
+    if ((flags & SolidE) != 0u) pE = pC;
+    if ((flags & SolidW) != 0u) pW = pC;
+    if ((flags & SolidU) != 0u) pU = pC;
+    if ((flags & SolidD) != 0u) pD = pC;
 
     vec4 bC = texelFetch(Divergence, T, 0);
-    FragColor = (pW + pE + pS + pN + pU + pD + Alpha * bC) * InverseBeta;
+    vec4 pJ = (pW + pE + pS + pN + pU + pD + Alpha * bC) * InverseBeta;
+
+    // Omega < 1 gives damped Jacobi, which is what the multigrid smoother wants
+    FragColor = mix(pC, pJ, Omega);
 }
\ No newline at end of file
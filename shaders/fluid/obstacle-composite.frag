@@ -0,0 +1,44 @@
+#version 400
+
+layout(location = 0) out float SolidOut;
+layout(location = 1) out vec3 VelocityOut;
+
+uniform sampler3D Walls;
+uniform usampler3D Masks[8];
+uniform mat4 PreviousFromCurrent[8];
+uniform int MaskCount;
+uniform float InverseTimeStep;
+
+in float gLayer;
+
+// Merges the static walls with every voxelized object. Masks are at the
+// density resolution, so a coarser destination voxel is solid when any of the
+// mask voxels it covers is. Objects move rigidly, so their velocity at a point
+// follows from where the previous frame's model matrix would have put it.
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 size = textureSize(Walls, 0);
+    vec3 p = (vec3(T) + 0.5) / vec3(size);
+
+    float solid = texelFetch(Walls, T, 0).x;
+    vec3 velocity = vec3(0);
+
+    for (int i = 0; i < MaskCount; ++i) {
+        ivec3 scale = textureSize(Masks[i], 0) / size;
+        bool inside = false;
+        for (int z = 0; z < scale.z; ++z)
+        for (int y = 0; y < scale.y; ++y)
+        for (int x = 0; x < scale.x; ++x) {
+            inside = inside || (texelFetch(Masks[i], T * scale + ivec3(x, y, z), 0).x & 1u) != 0u;
+        }
+        if (!inside) continue;
+
+        vec3 previous = (PreviousFromCurrent[i] * vec4(p, 1)).xyz;
+        solid = 1;
+        velocity = (p - previous) * vec3(size) * InverseTimeStep;
+    }
+
+    SolidOut = solid;
+    VelocityOut = velocity;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#version 400
+
+out uint FragColor;
+
+uniform sampler3D Source;
+
+in float gLayer;
+
+#include "solid-flags.glsl"
+
+// Packs whether this voxel and each of its six face neighbours are solid into
+// one byte, so the solver passes need a single fetch instead of seven.
+// Anything outside the volume counts as open, as it did when the passes read
+// their neighbours directly: the walls drawn into Source close off x and y,
+// but leave the two z faces mostly open.
+
+bool IsSolid(ivec3 T)
+{
+    if (any(lessThan(T, ivec3(0))) || any(greaterThanEqual(T, textureSize(Source, 0)))) {
+        return false;
+    }
+    return texelFetch(Source, T, 0).x > 0;
+}
+
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+
+    uint flags = 0u;
+    if (IsSolid(T + ivec3(0, 1, 0))) flags |= SolidN;
+    if (IsSolid(T + ivec3(0, -1, 0))) flags |= SolidS;
+    if (IsSolid(T + ivec3(1, 0, 0))) flags |= SolidE;
+    if (IsSolid(T + ivec3(-1, 0, 0))) flags |= SolidW;
+    if (IsSolid(T + ivec3(0, 0, 1))) flags |= SolidU;
+    if (IsSolid(T + ivec3(0, 0, -1))) flags |= SolidD;
+    if (IsSolid(T)) flags |= Solid;
+
+    FragColor = flags;
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+uniform sampler3D ObstacleVelocity;
+
+// Velocity of the obstacle filling voxel T of a grid this size, zero for the
+// walls. The volume is only allocated while an obstacle is moving and is a
+// single zero texel otherwise, so it's sampled by position, not fetched.
+vec3 ObstacleVelocityAt(ivec3 T, ivec3 size)
+{
+    return texture(ObstacleVelocity, (vec3(T) + 0.5) / vec3(size)).xyz;
+}
\ No newline at end of file
@@ -5,10 +5,13 @@ layout(triangle_strip, max_vertices = 3) out;
  
 in int vInstance[3];
 out float gLayer;
+
+// Lets a single instance land on any layer
+uniform int LayerOffset = 0;
  
 void main()
 {
-    gl_Layer = vInstance[0];
+    gl_Layer = vInstance[0] + LayerOffset;
     gLayer = float(gl_Layer) + 0.5;
     gl_Position = gl_in[0].gl_Position;
     EmitVertex();
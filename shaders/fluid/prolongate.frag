@@ -0,0 +1,19 @@
+#version 400
+
+out float FragColor;
+
+uniform sampler3D Pressure;
+uniform sampler3D Correction;
+uniform vec3 InverseSize;
+
+in float gLayer;
+
+// Interpolates the coarse grid error back up and adds it to the fine pressure.
+
+void main()
+{
+    vec3 fragCoord = vec3(gl_FragCoord.xy, gLayer);
+    float pC = texelFetch(Pressure, ivec3(fragCoord), 0).r;
+    float eC = texture(Correction, InverseSize * fragCoord).r;
+    FragColor = pC + eC;
+}
\ No newline at end of file
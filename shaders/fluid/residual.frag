@@ -0,0 +1,48 @@
+#version 400
+
+out vec2 FragColor;
+
+uniform sampler3D Pressure;
+uniform sampler3D Divergence;
+uniform usampler3D Obstacles;
+
+uniform float InverseCellSizeSquared;
+
+in float gLayer;
+
+#include "solid-flags.glsl"
+
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+
+    uint flags = texelFetch(Obstacles, T, 0).x;
+    if ((flags & Solid) != 0u) {
+        FragColor = vec2(0);
+        return;
+    }
+
+    // Find neighboring pressure:
+    float pN = texelFetchOffset(Pressure, T, 0, ivec3(0, 1, 0)).r;
+    float pS = texelFetchOffset(Pressure, T, 0, ivec3(0, -1, 0)).r;
+    float pE = texelFetchOffset(Pressure, T, 0, ivec3(1, 0, 0)).r;
+    float pW = texelFetchOffset(Pressure, T, 0, ivec3(-1, 0, 0)).r;
+    float pU = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, 1)).r;
+    float pD = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, -1)).r;
+    float pC = texelFetch(Pressure, T, 0).r;
+
+    // Use center pressure for solid cells:
+    if ((flags & SolidN) != 0u) pN = pC;
+    if ((flags & SolidS) != 0u) pS = pC;
+    if ((flags & SolidE) != 0u) pE = pC;
+    if ((flags & SolidW) != 0u) pW = pC;
+    if ((flags & SolidU) != 0u) pU = pC;
+    if ((flags & SolidD) != 0u) pD = pC;
+
+    // r = b - Ax, with A being the same Laplacian the Jacobi pass relaxes.
+    // The square goes in the second channel so a mip reduction yields the mean.
+    float bC = texelFetch(Divergence, T, 0).r;
+    float laplacian = (pW + pE + pS + pN + pU + pD - 6.0 * pC) * InverseCellSizeSquared;
+    float r = bC - laplacian;
+    FragColor = vec2(r, r * r);
+}
\ No newline at end of file
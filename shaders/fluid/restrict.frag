@@ -0,0 +1,17 @@
+#version 400
+
+out vec4 FragColor;
+
+uniform sampler3D Source;
+uniform vec3 InverseSize;
+
+in float gLayer;
+
+// Each coarse cell center sits in the middle of a 2x2x2 block of fine cells,
+// so a single trilinear fetch returns the average of all eight of them.
+
+void main()
+{
+    vec3 coord = InverseSize * vec3(gl_FragCoord.xy, gLayer);
+    FragColor = texture(Source, coord);
+}
\ No newline at end of file
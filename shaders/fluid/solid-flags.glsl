@@ -0,0 +1,9 @@
+// Obstacles holds a bitmask per voxel: Solid for the voxel itself and one bit
+// per face neighbour, built by obstacle-flags.frag.
+const uint SolidN = 1u;
+const uint SolidS = 2u;
+const uint SolidE = 4u;
+const uint SolidW = 8u;
+const uint SolidU = 16u;
+const uint SolidD = 32u;
+const uint Solid = 64u;
\ No newline at end of file
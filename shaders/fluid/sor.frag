@@ -0,0 +1,56 @@
+#version 400
+
+out vec4 FragColor;
+
+uniform sampler3D Pressure;
+uniform sampler3D Divergence;
+uniform usampler3D Obstacles;
+
+uniform float Alpha;
+uniform float InverseBeta;
+uniform float Omega;
+uniform int Parity;
+
+in float gLayer;
+
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
+// Red-black ordering: only cells whose checkerboard color matches Parity are
+// relaxed, the rest are copied through. Running both colors back to back gives
+// one Gauss-Seidel sweep, and Omega > 1 over-relaxes it into SOR.
+
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    vec4 pC = texelFetch(Pressure, T, 0);
+
+    // Inactive bricks are copied through like the other color
+    if (!Active(T, textureSize(Obstacles, 0)) || ((T.x + T.y + T.z) & 1) != Parity) {
+        FragColor = pC;
+        return;
+    }
+
+    // Find neighboring pressure:
+    vec4 pN = texelFetchOffset(Pressure, T, 0, ivec3(0, 1, 0));
+    vec4 pS = texelFetchOffset(Pressure, T, 0, ivec3(0, -1, 0));
+    vec4 pE = texelFetchOffset(Pressure, T, 0, ivec3(1, 0, 0));
+    vec4 pW = texelFetchOffset(Pressure, T, 0, ivec3(-1, 0, 0));
+    vec4 pU = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, 1));
+    vec4 pD = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, -1));
+
+    // One fetch says which neighbours are solid:
+    uint flags = texelFetch(Obstacles, T, 0).x;
+
+    // Use center pressure for solid cells:
+    if ((flags & SolidN) != 0u) pN = pC;
+    if ((flags & SolidS) != 0u) pS = pC;
+    if ((flags & SolidE) != 0u) pE = pC;
+    if ((flags & SolidW) != 0u) pW = pC;
+    if ((flags & SolidU) != 0u) pU = pC;
+    if ((flags & SolidD) != 0u) pD = pC;
+
+    vec4 bC = texelFetch(Divergence, T, 0);
+    vec4 pJ = (pW + pE + pS + pN + pU + pD + Alpha * bC) * InverseBeta;
+    FragColor = mix(pC, pJ, Omega);
+}
\ No newline at end of file
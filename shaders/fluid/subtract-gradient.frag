@@ -4,18 +4,27 @@ out vec3 FragColor;
 
 uniform sampler3D Velocity;
 uniform sampler3D Pressure;
-uniform sampler3D Obstacles;
+uniform usampler3D Obstacles;
 uniform float GradientScale;
 
 in float gLayer;
 
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+#include "obstacle-velocity.glsl"
+
 void main()
 {
     ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 size = textureSize(Obstacles, 0);
+    if (!Active(T, size)) {
+        FragColor = vec3(0);
+        return;
+    }
 
-    vec3 oC = texelFetch(Obstacles, T, 0).xyz;
-    if (oC.x > 0) {
-        FragColor = oC.yzx;
+    uint flags = texelFetch(Obstacles, T, 0).x;
+    if ((flags & Solid) != 0u) {
+        FragColor = ObstacleVelocityAt(T, size);
         return;
     }
 
@@ -28,28 +37,21 @@ void main()
     float pD = texelFetchOffset(Pressure, T, 0, ivec3(0, 0, -1)).r;
     float pC = texelFetch(Pressure, T, 0).r;
 
-    // Find neighboring obstacles:
-    vec3 oN = texelFetchOffset(Obstacles, T, 0, ivec3(0, 1, 0)).xyz;
-    vec3 oS = texelFetchOffset(Obstacles, T, 0, ivec3(0, -1, 0)).xyz;
-    vec3 oE = texelFetchOffset(Obstacles, T, 0, ivec3(1, 0, 0)).xyz;
-    vec3 oW = texelFetchOffset(Obstacles, T, 0, ivec3(-1, 0, 0)).xyz;
-    vec3 oU = texelFetchOffset(Obstacles, T, 0, ivec3(0, 0, 1)).xyz;
-    vec3 oD = texelFetchOffset(Obstacles, T, 0, ivec3(0, 0, -1)).xyz;
-
-    // Use center pressure for solid cells:
+    // Use center pressure for solid cells, and take the normal component of
+    // the velocity from the obstacle:
     vec3 obstV = vec3(0);
     vec3 vMask = vec3(1);
 
-    if (oN.x > 0) { pN = pC; obstV.y = oN.z; vMask.y = 0; }
-    if (oS.x > 0) { pS = pC; obstV.y = oS.z; vMask.y = 0; }
-    if (oE.x > 0) { pE = pC; obstV.x = oE.y; vMask.x = 0; }
-    if (oW.x > 0) { pW = pC; obstV.x = oW.y; vMask.x = 0; }
-    if (oU.x > 0) { pU = pC; obstV.z = oU.x; vMask.z = 0; }
-    if (oD.x > 0) { pD = pC; obstV.z = oD.x; vMask.z = 0; }
+    if ((flags & SolidN) != 0u) { pN = pC; obstV.y = ObstacleVelocityAt(T + ivec3(0, 1, 0), size).y; vMask.y = 0; }
+    if ((flags & SolidS) != 0u) { pS = pC; obstV.y = ObstacleVelocityAt(T + ivec3(0, -1, 0), size).y; vMask.y = 0; }
+    if ((flags & SolidE) != 0u) { pE = pC; obstV.x = ObstacleVelocityAt(T + ivec3(1, 0, 0), size).x; vMask.x = 0; }
+    if ((flags & SolidW) != 0u) { pW = pC; obstV.x = ObstacleVelocityAt(T + ivec3(-1, 0, 0), size).x; vMask.x = 0; }
+    if ((flags & SolidU) != 0u) { pU = pC; obstV.z = ObstacleVelocityAt(T + ivec3(0, 0, 1), size).z; vMask.z = 0; }
+    if ((flags & SolidD) != 0u) { pD = pC; obstV.z = ObstacleVelocityAt(T + ivec3(0, 0, -1), size).z; vMask.z = 0; }
 
     // Enforce the free-slip boundary condition:
     vec3 oldV = texelFetch(Velocity, T, 0).xyz;
     vec3 grad = vec3(pE - pW, pN - pS, pU - pD) * GradientScale;
     vec3 newV = oldV - grad;
-    FragColor = (vMask * newV) + obstV;  
+    FragColor = (vMask * newV) + obstV;
 }
\ No newline at end of file
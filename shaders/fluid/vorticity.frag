@@ -0,0 +1,48 @@
+#version 400
+
+out vec3 FragColor;
+
+uniform sampler3D Velocity;
+uniform usampler3D Obstacles;
+uniform float HalfInverseCellSize;
+
+in float gLayer;
+
+#include "brick-mask.glsl"
+#include "solid-flags.glsl"
+
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    if (!Active(T, textureSize(Obstacles, 0))) {
+        FragColor = vec3(0);
+        return;
+    }
+
+    // Find neighboring velocities:
+    vec3 vN = texelFetchOffset(Velocity, T, 0, ivec3(0, 1, 0)).xyz;
+    vec3 vS = texelFetchOffset(Velocity, T, 0, ivec3(0, -1, 0)).xyz;
+    vec3 vE = texelFetchOffset(Velocity, T, 0, ivec3(1, 0, 0)).xyz;
+    vec3 vW = texelFetchOffset(Velocity, T, 0, ivec3(-1, 0, 0)).xyz;
+    vec3 vU = texelFetchOffset(Velocity, T, 0, ivec3(0, 0, 1)).xyz;
+    vec3 vD = texelFetchOffset(Velocity, T, 0, ivec3(0, 0, -1)).xyz;
+
+    // One fetch says which neighbours are solid:
+    uint flags = texelFetch(Obstacles, T, 0).x;
+
+    // Obstacles are static, so solid cells contribute no velocity:
+    if ((flags & SolidN) != 0u) vN = vec3(0);
+    if ((flags & SolidS) != 0u) vS = vec3(0);
+    if ((flags & SolidE) != 0u) vE = vec3(0);
+    if ((flags & SolidW) != 0u) vW = vec3(0);
+    if ((flags & SolidU) != 0u) vU = vec3(0);
+    if ((flags & SolidD) != 0u) vD = vec3(0);
+
+    // Curl from central differences, one component per pair of axes
+    vec3 curl = HalfInverseCellSize * vec3(
+        (vN.z - vS.z) - (vU.y - vD.y),
+        (vU.x - vD.x) - (vE.z - vW.z),
+        (vE.y - vW.y) - (vN.x - vS.x));
+
+    FragColor = curl;
+}
\ No newline at end of file
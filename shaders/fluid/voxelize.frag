@@ -0,0 +1,15 @@
+#version 400
+
+out uint FragColor;
+
+in float gDepth;
+in float gLayer;
+
+// Counts the surfaces crossed by a ray from the voxel centre towards +z. The
+// framebuffer XORs every write, so the low bit ends up set when the count is
+// odd, which for a closed mesh means the voxel is inside.
+void main()
+{
+    if (gDepth < gLayer) discard;
+    FragColor = 1u;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#version 400
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vPosition[3];
+in int vInstance[3];
+out float gDepth;
+out float gLayer;
+
+uniform vec3 Size;
+
+// Projects the triangle straight along z onto one slice of the mask. Each
+// instance is a slice, and only surfaces beyond it matter to the parity test.
+void main()
+{
+    float layer = float(vInstance[0]) + 0.5;
+    if (max(vPosition[0].z, max(vPosition[1].z, vPosition[2].z)) < layer) {
+        return;
+    }
+
+    gl_Layer = vInstance[0];
+    for (int i = 0; i < 3; ++i) {
+        gl_Position = vec4(vPosition[i].xy / Size.xy * 2.0 - 1.0, 0, 1);
+        gDepth = vPosition[i].z;
+        gLayer = layer;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
\ No newline at end of file
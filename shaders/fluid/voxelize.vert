@@ -0,0 +1,16 @@
+#version 400
+
+// Shares attribute location 0 with model.vert, so the meshes' own vertex
+// arrays can be drawn with this program unchanged.
+layout(location = 0) in vec3 a_vertex;
+
+uniform mat4 VoxelFromObject;
+
+out vec3 vPosition;
+out int vInstance;
+
+void main()
+{
+    vPosition = (VoxelFromObject * vec4(a_vertex, 1)).xyz;
+    vInstance = gl_InstanceID;
+}
\ No newline at end of file
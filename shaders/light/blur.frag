@@ -3,30 +3,21 @@
 in float gLayer;
 out float FragColor;
 uniform sampler3D Density;
-uniform vec3 InverseSize;
-uniform float StepSize;
 uniform float DensityScale;
+uniform int Axis;
 
-float GetDensity(vec3 pos)
-{
-    return texture(Density, pos).x * DensityScale;
-}
-
-// This implements a super stupid filter in 3-Space that takes 7 samples.
-// A three-pass seperable Gaussian would be way better.
+#include "blur.glsl"
+#include "../fluid/brick-mask.glsl"
 
+// One pass of the blur, run once along each axis
 void main()
 {
-    vec3 pos = InverseSize * vec3(gl_FragCoord.xy, gLayer);
-    float e = StepSize;
-    float z = e;
-    float density = GetDensity(pos);
-    density += GetDensity(pos + vec3(e,e,0));
-    density += GetDensity(pos + vec3(-e,e,0));
-    density += GetDensity(pos + vec3(e,-e,0));
-    density += GetDensity(pos + vec3(-e,-e,0));
-    density += GetDensity(pos + vec3(0,0,-z));
-    density += GetDensity(pos + vec3(0,0,+z));
-    density /= 7;
-    FragColor =  density;
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 size = textureSize(Density, 0);
+    if (!Active(T, size)) {
+        FragColor = 0;
+        return;
+    }
+
+    FragColor = Blur(Density, T, size, Axis) * DensityScale;
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+// The density blur, shared by blur.frag and the sweep that can take over its
+// last pass. MaxBlurRadius in smokem.cpp has to match.
+const int MaxBlurRadius = 6;
+
+uniform int BlurRadius;
+uniform float BlurWeights[MaxBlurRadius + 1];
+
+// One pass of a separable Gaussian at voxel T, along `axis`. Every tap is a
+// single texel clamped to the volume, so a radius of r costs 2r + 1 fetches.
+float Blur(sampler3D source, ivec3 T, ivec3 size, int axis)
+{
+    ivec3 dir = ivec3(0);
+    dir[axis] = 1;
+
+    float density = BlurWeights[0] * texelFetch(source, T, 0).x;
+    for (int i = 1; i <= BlurRadius; ++i) {
+        density += BlurWeights[i] * texelFetch(source, clamp(T + i * dir, ivec3(0), size - 1), 0).x;
+        density += BlurWeights[i] * texelFetch(source, clamp(T - i * dir, ivec3(0), size - 1), 0).x;
+    }
+    return density;
+}
\ No newline at end of file
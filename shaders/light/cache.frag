@@ -1,25 +1,25 @@
 #version 400
 
 in float gLayer;
-out float FragColor;
+out vec3 FragColor;
 
 uniform sampler3D Density;
-uniform vec3 LightPosition = vec3(1.0, 1.0, 2.0);
-uniform float LightIntensity = 10.0;
-uniform float Absorption = 10.0;
 uniform float LightStep;
 uniform int LightSamples;
 uniform vec3 InverseSize;
 
+#include "light-batch.glsl"
+#include "../fluid/brick-mask.glsl"
+
 float GetDensity(vec3 pos)
 {
     return texture(Density, pos).x;
 }
 
-void main()
+// Marches from pos towards the light until the smoke has swallowed it
+float Transmittance(vec3 pos, vec3 lightPosition)
 {
-    vec3 pos = InverseSize * vec3(gl_FragCoord.xy, gLayer);
-    vec3 lightDir = normalize(LightPosition-pos) * LightStep;
+    vec3 lightDir = normalize(lightPosition-pos) * LightStep;
     float Tl = 1.0;
     vec3 lpos = pos + lightDir;
     
@@ -37,6 +37,16 @@ void main()
         lpos += lightDir;
     }
 
-    float Li = LightIntensity*Tl;
-    FragColor = Li;
+    return Tl;
+}
+
+void main()
+{
+    vec3 pos = InverseSize * vec3(gl_FragCoord.xy, gLayer);
+    bool active = Active(ivec3(gl_FragCoord.xy, gLayer), textureSize(Density, 0));
+
+    FragColor = vec3(0);
+    for (int i = 0; i < LightCount; ++i) {
+        FragColor += LightColors[i] * (active ? Transmittance(pos, LightPositions[i]) : 1.0);
+    }
 }
\ No newline at end of file
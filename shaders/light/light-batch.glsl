@@ -0,0 +1,8 @@
+// Lights sharing a pass of the light cache, one per transmittance channel.
+// LightBatchSize in smokem.cpp has to match.
+const int BatchSize = 4;
+
+uniform vec3 LightPositions[BatchSize];
+uniform vec3 LightColors[BatchSize];
+uniform int LightCount;
+uniform float Absorption = 10.0;
\ No newline at end of file
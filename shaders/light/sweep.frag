@@ -0,0 +1,67 @@
+#version 400
+
+in float gLayer;
+layout(location = 0) out vec4 Transmittance;
+layout(location = 1) out vec3 FragColor;
+layout(location = 2) out float BlurredDensity;
+
+uniform sampler3D Density;
+uniform sampler3D Previous;
+uniform int Axis;
+uniform int Direction;
+
+// The density blur's last pass, along the sweep axis, can be done here. The
+// sweep then attenuates with density blurred along the other two axes only,
+// which is why smokem.cpp only fuses when every light fits in one batch.
+uniform bool FuseBlur = false;
+
+#include "light-batch.glsl"
+#include "blur.glsl"
+#include "../fluid/brick-mask.glsl"
+
+// One slice of the light cache sweep. The slices run away from the light
+// along its dominant axis, and each voxel follows its ray towards the light
+// back to the previous slice. It takes the transmittance already stored there
+// and attenuates it by the density in between. That replaces the per-voxel
+// march in cache.frag with two lookups.
+//
+// Up to four lights that sweep the same way share a pass, one transmittance
+// channel each, and their light is summed into the cache.
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 size = textureSize(Density, 0);
+    vec3 pos = (vec3(T) + 0.5) / vec3(size);
+
+    Transmittance = vec4(1);
+    FragColor = vec3(0);
+    BlurredDensity = 0;
+    if (FuseBlur && Active(T, size)) {
+        BlurredDensity = Blur(Density, T, size, Axis);
+    }
+
+    for (int i = 0; i < LightCount; ++i) {
+        vec3 toLight = LightPositions[i] - pos;
+        float along = toLight[Axis] * float(Direction);
+        if (along <= 0) {
+            // The light is level with this slice, or behind it
+            FragColor += LightColors[i];
+            continue;
+        }
+
+        vec3 step = toLight / (along * float(size[Axis]));
+        vec3 previous = pos + step;
+
+        // The first slice and rays leaving through the sides see no smoke beyond
+        float Tl = 1.0;
+        if (all(greaterThanEqual(previous, vec3(0))) && all(lessThanEqual(previous, vec3(1)))) {
+            Tl = texture(Previous, previous)[i];
+        }
+
+        float d = texture(Density, pos + 0.5 * step).x;
+        Tl *= exp(-Absorption * length(step) * d);
+
+        Transmittance[i] = Tl;
+        FragColor += LightColors[i] * Tl;
+    }
+}
\ No newline at end of file
@@ -1,6 +1,6 @@
 #version 400
 
-const int numberOfLights = 1;
+const int numberOfLights = 8;
 
 const float attnConst = 0.98;
 const float attnLinear = 0.025;
@@ -11,6 +11,7 @@ uniform vec3 lightAmbients[numberOfLights]; // ambient values for each light sou
 uniform vec3 lightDiffuses[numberOfLights]; // diffuse values for each light source
 uniform vec3 lightSpeculars[numberOfLights]; // specular values for each light source
 uniform float lightBrightnesses[numberOfLights]; // brightnesses of each light.
+uniform int lightCount = 1; // how many of the above are in use
 
 uniform vec3 mtl_ambient; // ambient material value
 uniform vec3 mtl_diffuse; // diffuse material value
@@ -81,7 +82,7 @@ void main()
     vec3 NN = texture(tex_norm, texCoord.st).xyz;
     vec3 N = normal + normalize(2.0 * NN.xyz - 1.0);
 
-    for (int i = 0; i < numberOfLights; i++)
+    for (int i = 0; i < lightCount; i++)
     {
         fragColor.xyz += phongLight(
             vertex,
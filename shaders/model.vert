@@ -5,7 +5,8 @@ uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 uniform mat3 normal_matrix;
 
-in vec3 a_vertex;
+// Pinned so other programs can draw the same vertex arrays
+layout(location = 0) in vec3 a_vertex;
 in vec3 a_normal;
 in vec2 a_tex_coord;
 
@@ -0,0 +1,30 @@
+#version 400
+
+out float FragColor;
+
+uniform sampler3D Density;
+
+in float gLayer;
+
+const int BrickSize = 8;
+
+// Finds the largest density a ray could see inside this brick. Trilinear
+// lookups near a face blend in the neighbouring brick's voxels, so the search
+// covers a one voxel apron around the brick as well.
+void main()
+{
+    ivec3 brick = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 first = max(brick * BrickSize - 1, ivec3(0));
+    ivec3 last = min(brick * BrickSize + BrickSize, textureSize(Density, 0) - 1);
+
+    float result = 0;
+    for (int z = first.z; z <= last.z; ++z) {
+        for (int y = first.y; y <= last.y; ++y) {
+            for (int x = first.x; x <= last.x; ++x) {
+                result = max(result, texelFetch(Density, ivec3(x, y, z), 0).x);
+            }
+        }
+    }
+
+    FragColor = result;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#version 400
+
+out float FragColor;
+
+uniform sampler3D Source;
+
+in float gLayer;
+
+// Keeps the largest of the 2x2x2 texels below this one. The sampler only sees
+// the level being reduced. When that level has an odd size, the last texel
+// also takes the leftover row.
+void main()
+{
+    ivec3 T = ivec3(gl_FragCoord.xy, gLayer);
+    ivec3 fine = textureSize(Source, 0);
+    ivec3 coarse = max(fine / 2, ivec3(1));
+
+    ivec3 first = T * 2;
+    ivec3 last = min(first + 1, fine - 1);
+    if (T.x == coarse.x - 1) last.x = fine.x - 1;
+    if (T.y == coarse.y - 1) last.y = fine.y - 1;
+    if (T.z == coarse.z - 1) last.z = fine.z - 1;
+
+    float result = 0;
+    for (int z = first.z; z <= last.z; ++z) {
+        for (int y = first.y; y <= last.y; ++y) {
+            for (int x = first.x; x <= last.x; ++x) {
+                result = max(result, texelFetch(Source, ivec3(x, y, z), 0).x);
+            }
+        }
+    }
+
+    FragColor = result;
+}
\ No newline at end of file
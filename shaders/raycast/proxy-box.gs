@@ -0,0 +1,43 @@
+#version 400
+
+layout(points) in;
+layout(triangle_strip, max_vertices = 24) out;
+
+uniform mat4 ViewProjection;
+uniform vec3 RayOrigin;
+uniform vec3 VolumeMin;
+uniform float VolumeSize;
+
+void EmitCorner(vec3 corner)
+{
+    gl_Position = ViewProjection * vec4(VolumeMin + corner * VolumeSize, 1);
+    EmitVertex();
+}
+
+// Emits one face of the unit box, given its outward normal and two edges,
+// but only when it faces away from the eye.
+void EmitFace(vec3 normal, vec3 u, vec3 v)
+{
+    vec3 center = 0.5 + 0.5 * normal;
+    if (dot(normal, VolumeMin + center * VolumeSize - RayOrigin) <= 0) return;
+
+    vec3 corner = center - 0.5 * u - 0.5 * v;
+    EmitCorner(corner);
+    EmitCorner(corner + u);
+    EmitCorner(corner + v);
+    EmitCorner(corner + u + v);
+    EndPrimitive();
+}
+
+// Rasterizes the back faces of the volume's box, so only the pixels it covers
+// are shaded, each of them once. Unlike the front faces, these still cover the
+// view when the camera is inside the box.
+void main()
+{
+    EmitFace(vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1));
+    EmitFace(vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1));
+    EmitFace(vec3(0, 1, 0), vec3(1, 0, 0), vec3(0, 0, 1));
+    EmitFace(vec3(0, -1, 0), vec3(1, 0, 0), vec3(0, 0, 1));
+    EmitFace(vec3(0, 0, 1), vec3(1, 0, 0), vec3(0, 1, 0));
+    EmitFace(vec3(0, 0, -1), vec3(1, 0, 0), vec3(0, 1, 0));
+}
\ No newline at end of file
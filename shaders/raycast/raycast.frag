@@ -4,6 +4,7 @@ out vec4 FragColor;
 
 uniform sampler3D Density;
 uniform sampler3D LightCache;
+uniform sampler3D DensityMax;
 
 uniform mat4 InverseProjectionMatrix;
 uniform mat4 InverseViewMatrix;
@@ -15,6 +16,29 @@ uniform vec3 LightColor = vec3(1, 1, 1);
 uniform float Absorption = 10.0;
 uniform float LightSamples;
 uniform int ViewSamples;
+uniform vec3 VolumeMin = vec3(20, 0, 20);
+uniform float VolumeSize = 8.0;
+uniform int MaxLevel;
+uniform float EmptyDensity = 0.01;
+
+// Offscreen rendering stops rays at the nearest model and writes premultiplied
+// colour for resolve.frag to composite.
+uniform bool Offscreen = false;
+uniform sampler2D SceneDistance;
+
+// Temporal mode marches every TemporalFrames-th step, starting at a phase that
+// changes each frame, and blends the result into the reprojected history.
+uniform int TemporalFrames = 1;
+uniform float StepPhase = 0.0;
+uniform float HistoryWeight = 1.0;
+uniform sampler2D History;
+uniform mat4 PreviousViewProjection;
+
+// Per-pixel offset in [0, 1) that keeps neighbouring rays from stepping in lockstep
+float InterleavedGradientNoise(vec2 pixel)
+{
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
 
 float GetDensity(vec3 pos)
 {
@@ -33,6 +57,51 @@ struct AABB
     vec3 Max;
 };
 
+// DensityMax holds the largest density in each brick at level 0, and the
+// largest of the eight texels below at every level above. A cell is worth
+// marching when it may hold smoke or reaches down into the floor. lo and hi
+// return its bounds in volume coordinates; the last cell of an odd sized
+// level also covers the leftover texels below it.
+bool Occupied(ivec3 cell, int level, out vec3 lo, out vec3 hi)
+{
+    ivec3 base = textureSize(DensityMax, 0);
+    ivec3 size = textureSize(DensityMax, level);
+    lo = vec3(cell << level) / vec3(base);
+    hi = mix(vec3((cell + 1) << level), vec3(base), equal(cell, size - 1)) / vec3(base);
+    return lo.z < 0.1 || texelFetch(DensityMax, cell, level).x > EmptyDensity;
+}
+
+// Walks from t towards tEnd through the pyramid, descending into cells that
+// may hold smoke and jumping over the ones that can't. Returns where the ray
+// enters the first occupied brick, or tEnd when it never does.
+float SkipEmpty(Ray r, float t, float tEnd)
+{
+    ivec3 base = textureSize(DensityMax, 0);
+    float nudge = 1e-4 * VolumeSize;
+    int level = MaxLevel;
+
+    for (int n = 0; n < 128 && t < tEnd; ++n) {
+        vec3 p = (r.Origin + r.Dir * (t + nudge) - VolumeMin) / VolumeSize;
+        ivec3 cell = clamp(ivec3(p * vec3(base)), ivec3(0), base - 1) >> level;
+        cell = min(cell, textureSize(DensityMax, level) - 1);
+
+        vec3 lo, hi;
+        if (Occupied(cell, level, lo, hi)) {
+            if (level == 0) return t;
+            --level;
+            continue;
+        }
+
+        // Leave through whichever face the ray reaches first, then look wider again
+        vec3 bound = VolumeMin + mix(lo, hi, greaterThan(r.Dir, vec3(0))) * VolumeSize;
+        vec3 exits = mix(vec3(1e30), (bound - r.Origin) / r.Dir, notEqual(r.Dir, vec3(0)));
+        t = max(min(exits.x, min(exits.y, exits.z)), t + nudge);
+        level = min(level + 1, MaxLevel);
+    }
+
+    return min(t, tEnd);
+}
+
 bool IntersectBox(Ray r, AABB aabb, out float t0, out float t1)
 {
     vec3 invR = 1.0 / r.Dir;
@@ -58,28 +127,56 @@ void main()
     vec4 ray_eye = vec4((InverseProjectionMatrix * ray_clip).xyz, 0.0);
     vec3 ray_wor = normalize((InverseViewMatrix * ray_eye).xyz);
 
-    vec3 objPos = vec3(20, 0, 20);
-
     Ray eye = Ray(RayOrigin, ray_wor);
-    AABB aabb = AABB(objPos, objPos + vec3(1) * 8);
+    AABB aabb = AABB(VolumeMin, VolumeMin + vec3(VolumeSize));
 
     float tnear, tfar;
-    if (!IntersectBox(eye, aabb, tnear, tfar)) return;
+    if (!IntersectBox(eye, aabb, tnear, tfar)) {
+        FragColor = vec4(0);
+        return;
+    }
+
+    // The camera may be inside the box
+    tnear = max(tnear, 0.0);
+
+    if (Offscreen) {
+        tfar = min(tfar, texelFetch(SceneDistance, ivec2(gl_FragCoord.xy), 0).x);
+        if (tfar <= tnear) {
+            FragColor = vec4(0);
+            return;
+        }
+    }
 
     float T = 1.0;
     vec3 Lo = Ambient;
 
-    float stepSize = (tfar - tnear) / ViewSamples;
+    // Fewer, longer steps keep the same total opacity by weighting each one more
+    int steps = max(ViewSamples / TemporalFrames, 1);
+    float stepSize = (tfar - tnear) / steps;
+    float stepWeight = LightSamples * TemporalFrames;
+    float offset = TemporalFrames > 1 ? (StepPhase + InterleavedGradientNoise(gl_FragCoord.xy)) / TemporalFrames : 0.0;
+
+    // Where along the ray the smoke is, for reprojecting the history
+    float depthSum = 0;
+    float weightSum = 0;
+
+    // Only march between the first and last bricks that may hold smoke. Both
+    // ends stay on the same sample lattice as a full march.
+    float tStart = SkipEmpty(eye, tnear, tfar);
+    float tEnd = tfar - SkipEmpty(Ray(eye.Origin + eye.Dir * tfar, -eye.Dir), 0.0, tfar - tStart);
 
-    for (int i = 0; i < ViewSamples; i++)
+    for (int i = max(int(ceil((tStart - tnear) / stepSize - offset)), 0); i < steps; i++)
     {
-        vec3 newPos = eye.Origin + eye.Dir * (tnear + i * stepSize);
+        float t = tnear + (i + offset) * stepSize;
+        if (t > tEnd) break;
+
+        vec3 newPos = eye.Origin + eye.Dir * t;
 
         // pos is the global position but we need the local when sampling the texture
-        vec3 localPos = (newPos - aabb.Min) / 8;
+        vec3 localPos = (newPos - aabb.Min) / VolumeSize;
         vec3 lightColor = LightColor;
 
-        float density = texture(Density, localPos).x;
+        float density;
 
         if (localPos.z < 0.1)
         {
@@ -87,20 +184,52 @@ void main()
             density = 10;
             lightColor = 3 * Ambient;
         }
-        else if (density <= 0.01)
+        else
         {
-            continue;
+            // Empty bricks are skipped whole, landing on the next sample past
+            // them. The brick is looked up exactly where SkipEmpty will look,
+            // and the index never goes backwards even if it returns t itself.
+            ivec3 bricks = textureSize(DensityMax, 0);
+            vec3 probe = (eye.Origin + eye.Dir * (t + 1e-4 * VolumeSize) - VolumeMin) / VolumeSize;
+            ivec3 brick = clamp(ivec3(probe * vec3(bricks)), ivec3(0), bricks - 1);
+            vec3 lo, hi;
+            if (!Occupied(brick, 0, lo, hi)) {
+                float next = SkipEmpty(eye, t, tEnd);
+                i = max(i, int(ceil((next - tnear) / stepSize - offset)) - 1);
+                continue;
+            }
+
+            density = texture(Density, localPos).x;
+            if (density <= 0.01) continue;
         }
 
-        T *= 1.0 - density * LightSamples * Absorption;
+        T *= 1.0 - density * stepWeight * Absorption;
         if (T <= 0.01) break;
 
-        vec3 Li = lightColor * texture(LightCache, localPos).xxx;
-        Lo += Li * T * density * LightSamples;
+        vec3 Li = lightColor * texture(LightCache, localPos).rgb;
+        Lo += Li * T * density * stepWeight;
+
+        depthSum += t * T * density;
+        weightSum += T * density;
     }
 
-    FragColor.rgb = Lo;
-    FragColor.a = 1 - T;
+    if (!Offscreen) {
+        FragColor.rgb = Lo;
+        FragColor.a = 1 - T;
+        return;
+    }
+
+    // The history is premultiplied so it can be blended and composited linearly
+    vec4 current = vec4(Lo * (1 - T), 1 - T);
+    FragColor = current;
+    if (HistoryWeight >= 1.0) return;
+
+    float depth = weightSum > 0 ? depthSum / weightSum : tnear;
+    vec4 previous = PreviousViewProjection * vec4(eye.Origin + eye.Dir * depth, 1);
+    vec2 uv = previous.xy / previous.w * 0.5 + 0.5;
+    if (previous.w > 0 && all(greaterThanEqual(uv, vec2(0))) && all(lessThanEqual(uv, vec2(1)))) {
+        FragColor = mix(texture(History, uv), current, HistoryWeight);
+    }
 
-    // FragColor = vec4((pos - aabb.Min) / 8, 1);
+    // FragColor = vec4((pos - aabb.Min) / VolumeSize, 1);
 }
\ No newline at end of file
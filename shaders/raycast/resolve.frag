@@ -0,0 +1,46 @@
+#version 400
+
+out vec4 FragColor;
+
+uniform sampler2D Source;
+uniform sampler2D LowDistance;
+uniform int Scale;
+uniform float DepthTolerance = 0.1;
+
+#include "scene-distance.glsl"
+
+// Composites the offscreen smoke, which is premultiplied, over the scene. The
+// four nearest low resolution texels are blended bilinearly while their depth
+// agrees with this pixel's. Across a model's silhouette the texel with the
+// closest depth is used on its own, so smoke doesn't bleed over the edge.
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float sceneDistance = DistanceAt(pixel);
+
+    vec2 low = (vec2(pixel) + 0.5) / float(Scale) - 0.5;
+    ivec2 base = ivec2(floor(low));
+    vec2 f = low - vec2(base);
+    ivec2 size = textureSize(Source, 0);
+
+    vec4 bilinear = vec4(0);
+    vec4 nearest = vec4(0);
+    float nearestError = 1e30;
+    bool agree = true;
+
+    for (int i = 0; i < 4; ++i) {
+        ivec2 o = ivec2(i & 1, i >> 1);
+        ivec2 t = clamp(base + o, ivec2(0), size - 1);
+        vec4 smoke = texelFetch(Source, t, 0);
+        float error = abs(texelFetch(LowDistance, t, 0).x - sceneDistance) / sceneDistance;
+
+        bilinear += smoke * (o.x == 1 ? f.x : 1 - f.x) * (o.y == 1 ? f.y : 1 - f.y);
+        if (error < nearestError) {
+            nearestError = error;
+            nearest = smoke;
+        }
+        agree = agree && error < DepthTolerance;
+    }
+
+    FragColor = agree ? bilinear : nearest;
+}
\ No newline at end of file
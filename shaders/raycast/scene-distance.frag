@@ -0,0 +1,22 @@
+#version 400
+
+out float FragColor;
+
+uniform int Scale;
+
+#include "scene-distance.glsl"
+
+// Keeps the nearest model in each block of window pixels, so no low
+// resolution ray marches through one.
+void main()
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * Scale;
+
+    float nearest = 65504.0;
+    for (int y = 0; y < Scale; ++y)
+    for (int x = 0; x < Scale; ++x) {
+        nearest = min(nearest, DistanceAt(base + ivec2(x, y)));
+    }
+
+    FragColor = nearest;
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+uniform sampler2D SceneDepth;
+uniform mat4 InverseViewProjection;
+uniform vec3 RayOrigin;
+
+// Distance from the eye to what the depth buffer holds at this pixel, or the
+// largest half float where nothing was drawn.
+float DistanceAt(ivec2 pixel)
+{
+    float depth = texelFetch(SceneDepth, pixel, 0).x;
+    if (depth >= 1.0) return 65504.0;
+
+    vec2 uv = (vec2(pixel) + 0.5) / vec2(textureSize(SceneDepth, 0));
+    vec4 world = InverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1);
+    return length(world.xyz / world.w - RayOrigin);
+}
\ No newline at end of file
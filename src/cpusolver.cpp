@@ -0,0 +1,600 @@
+#include "cpusolver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Splits a volume into z slabs and hands them out to a fixed set of workers.
+// The calling thread works too, and run() returns once every slab is done.
+class SlabPool
+{
+public:
+    SlabPool()
+    {
+        int count = std::max(1, int(std::thread::hardware_concurrency()));
+        for (int i = 1; i < count; ++i)
+        {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~SlabPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void run(int depth, const std::function<void(int, int)>& kernel)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = kernel;
+            jobDepth = depth;
+
+            // A few slabs per thread evens out the rows that hit the slower edge path
+            slab = std::max(1, depth / (int(workers.size() + 1) * 4));
+            next = 0;
+            busy = int(workers.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        drain();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+
+private:
+    void drain()
+    {
+        for (;;)
+        {
+            int z0 = next.fetch_add(slab);
+            if (z0 >= jobDepth)
+            {
+                return;
+            }
+            job(z0, std::min(z0 + slab, jobDepth));
+        }
+    }
+
+    void work()
+    {
+        unsigned seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+
+            drain();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    std::function<void(int, int)> job;
+    int jobDepth = 0;
+    int slab = 1;
+    std::atomic<int> next;
+    int busy = 0;
+    unsigned generation = 0;
+    bool quit = false;
+};
+
+static void ForEachSlab(int depth, const std::function<void(int, int)>& kernel)
+{
+    static SlabPool pool;
+    pool.run(depth, kernel);
+}
+
+struct Grid {
+    int W, H, D;
+    ptrdiff_t Row, Slice;
+
+    Grid(const CpuSurfacePod& s) : W(s.Width), H(s.Height), D(s.Depth), Row(s.Width), Slice(ptrdiff_t(s.Width) * s.Height) {}
+
+    ptrdiff_t at(int x, int y, int z) const
+    {
+        return x + Row * y + Slice * z;
+    }
+
+    // texelFetch outside the volume is undefined on the GPU, here it clamps to the edge
+    ptrdiff_t clamped(int x, int y, int z) const
+    {
+        return at(std::min(std::max(x, 0), W - 1), std::min(std::max(y, 0), H - 1), std::min(std::max(z, 0), D - 1));
+    }
+};
+
+struct Neighbours {
+    ptrdiff_t C, N, S, E, W, U, D;
+};
+
+static inline Neighbours Around(const Grid& g, int x, int y, int z, bool edge)
+{
+    if (!edge)
+    {
+        ptrdiff_t i = g.at(x, y, z);
+        return { i, i + g.Row, i - g.Row, i + 1, i - 1, i + g.Slice, i - g.Slice };
+    }
+
+    return {
+        g.at(x, y, z),
+        g.clamped(x, y + 1, z), g.clamped(x, y - 1, z),
+        g.clamped(x + 1, y, z), g.clamped(x - 1, y, z),
+        g.clamped(x, y, z + 1), g.clamped(x, y, z - 1)
+    };
+}
+
+// Walks the slab [z0, z1) row by row. Voxels on the outer shell of the grid go
+// through the scalar kernel with clamped neighbours. The inside of each row
+// goes to the 8-wide kernel, which returns the first x it left for the scalar one.
+template <typename Scalar, typename Vector>
+static void StencilRows(const Grid& g, int z0, int z1, Scalar scalar, Vector vector)
+{
+    for (int z = z0; z < z1; ++z)
+    {
+        for (int y = 0; y < g.H; ++y)
+        {
+            if (z == 0 || z == g.D - 1 || y == 0 || y == g.H - 1 || g.W < 3)
+            {
+                for (int x = 0; x < g.W; ++x)
+                {
+                    scalar(x, y, z, true);
+                }
+                continue;
+            }
+
+            scalar(0, y, z, true);
+            for (int x = vector(1, y, z); x < g.W - 1; ++x)
+            {
+                scalar(x, y, z, false);
+            }
+            scalar(g.W - 1, y, z, true);
+        }
+    }
+}
+
+#ifdef __AVX2__
+// A neighbour's value, or the fallback wherever that neighbour is solid
+static inline __m256 Neighbour(const float* values, const float* solid, ptrdiff_t i, __m256 fallback)
+{
+    __m256 mask = _mm256_cmp_ps(_mm256_loadu_ps(solid + i), _mm256_setzero_ps(), _CMP_GT_OQ);
+    return _mm256_blendv_ps(_mm256_loadu_ps(values + i), fallback, mask);
+}
+
+static inline __m256 IsSolid(const float* solid, ptrdiff_t i)
+{
+    return _mm256_cmp_ps(_mm256_loadu_ps(solid + i), _mm256_setzero_ps(), _CMP_GT_OQ);
+}
+#endif
+
+CpuSurfacePod CreateCpuVolume(int width, int height, int depth, int numComponents)
+{
+    CpuSurfacePod surface;
+    surface.Width = width;
+    surface.Height = height;
+    surface.Depth = depth;
+    surface.Components = numComponents;
+
+    for (int c = 0; c < numComponents; ++c)
+    {
+        surface.Channels[c].assign(size_t(width) * height * depth, 0.0f);
+    }
+    return surface;
+}
+
+CpuSlabPod CreateCpuSlab(int width, int height, int depth, int numComponents)
+{
+    CpuSlabPod slab;
+    slab.Ping = CreateCpuVolume(width, height, depth, numComponents);
+    slab.Pong = CreateCpuVolume(width, height, depth, numComponents);
+    return slab;
+}
+
+// The same walls CreateObstacles draws on the GPU: a one voxel border around
+// every slice but the two end ones, and on layer 0 the small disc its sphere
+// code leaves behind. The z ends are otherwise open. Outside the volume this
+// solver clamps to the edge, where texelFetch on the GPU is undefined, so the
+// two only track each other closely away from the open ends.
+void CreateObstacles(CpuSurfacePod& dest)
+{
+    Grid g(dest);
+    ClearSurface(dest, 0);
+
+    // The GPU loop draws slice s into layer D - 1 - s, so its last slice lands here
+    float half = g.D / 2.0f;
+    float radius = 0.25f * (1 - sqrtf(std::abs(g.D - 1 - half) / half)) * 100;
+
+    for (int z = 0; z < g.D; ++z)
+    {
+        for (int y = 0; y < g.H; ++y)
+        {
+            for (int x = 0; x < g.W; ++x)
+            {
+                bool wall = false;
+                if (z > 0 && z < g.D - 1)
+                {
+                    wall = x == 0 || y == 0 || x == g.W - 1 || y == g.H - 1;
+                }
+                else if (z == 0)
+                {
+                    float u = (x + 0.5f) * 2 / g.W - 1;
+                    float v = (y + 0.5f) * 2 / g.H - 1;
+                    wall = u * u + v * v <= radius * radius;
+                }
+                dest.Channels[0][g.at(x, y, z)] = wall ? 1.0f : 0.0f;
+            }
+        }
+    }
+}
+
+void UploadVolume(const CpuSurfacePod& source, SurfacePod dest)
+{
+    size_t count = size_t(source.Width) * source.Height * source.Depth;
+    std::vector<float> interleaved(count * source.Components);
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int c = 0; c < source.Components; ++c)
+        {
+            interleaved[i * source.Components + c] = source.Channels[c][i];
+        }
+    }
+
+    const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_3D, dest.ColorTexture);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, source.Width, source.Height, source.Depth,
+                    formats[source.Components - 1], GL_FLOAT, interleaved.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void SwapSurfaces(CpuSlabPod* slab)
+{
+    std::swap(slab->Ping, slab->Pong);
+}
+
+void ClearSurface(CpuSurfacePod& s, float v)
+{
+    for (int c = 0; c < s.Components; ++c)
+    {
+        std::fill(s.Channels[c].begin(), s.Channels[c].end(), v);
+    }
+}
+
+void Advect(const CpuSurfacePod& velocity, const CpuSurfacePod& source, const CpuSurfacePod& obstacles, CpuSurfacePod& dest, float dissipation)
+{
+    Grid g(dest);
+    float timeStep = GetSimulationSettings().TimeStep;
+
+    const float* vx = velocity.Channels[0].data();
+    const float* vy = velocity.Channels[1].data();
+    const float* vz = velocity.Channels[2].data();
+    const float* solid = obstacles.Channels[0].data();
+
+    ForEachSlab(g.D, [&](int z0, int z1) {
+        for (int z = z0; z < z1; ++z)
+        {
+            for (int y = 0; y < g.H; ++y)
+            {
+                for (int x = 0; x < g.W; ++x)
+                {
+                    ptrdiff_t i = g.at(x, y, z);
+                    if (solid[i] > 0)
+                    {
+                        for (int c = 0; c < dest.Components; ++c)
+                        {
+                            dest.Channels[c][i] = 0;
+                        }
+                        continue;
+                    }
+
+                    // Trace back from the voxel centre, then filter like GL_LINEAR
+                    // with CLAMP_TO_EDGE, whose texel centres sit at half-integers
+                    float px = x - timeStep * vx[i];
+                    float py = y - timeStep * vy[i];
+                    float pz = z - timeStep * vz[i];
+
+                    int bx = int(std::floor(px));
+                    int by = int(std::floor(py));
+                    int bz = int(std::floor(pz));
+                    float tx = px - bx;
+                    float ty = py - by;
+                    float tz = pz - bz;
+
+                    ptrdiff_t c000 = g.clamped(bx, by, bz), c100 = g.clamped(bx + 1, by, bz);
+                    ptrdiff_t c010 = g.clamped(bx, by + 1, bz), c110 = g.clamped(bx + 1, by + 1, bz);
+                    ptrdiff_t c001 = g.clamped(bx, by, bz + 1), c101 = g.clamped(bx + 1, by, bz + 1);
+                    ptrdiff_t c011 = g.clamped(bx, by + 1, bz + 1), c111 = g.clamped(bx + 1, by + 1, bz + 1);
+
+                    for (int c = 0; c < dest.Components; ++c)
+                    {
+                        const float* s = source.Channels[c].data();
+                        float a = s[c000] + tx * (s[c100] - s[c000]);
+                        float b = s[c010] + tx * (s[c110] - s[c010]);
+                        float e = s[c001] + tx * (s[c101] - s[c001]);
+                        float f = s[c011] + tx * (s[c111] - s[c011]);
+                        float lower = a + ty * (b - a);
+                        float upper = e + ty * (f - e);
+                        dest.Channels[c][i] = dissipation * (lower + tz * (upper - lower));
+                    }
+                }
+            }
+        }
+    });
+}
+
+void Jacobi(const CpuSurfacePod& pressure, const CpuSurfacePod& divergence, const CpuSurfacePod& obstacles, CpuSurfacePod& dest, float cellSize, float omega)
+{
+    Grid g(dest);
+    float alpha = -cellSize * cellSize;
+    float inverseBeta = 0.1666f;
+
+    const float* p = pressure.Channels[0].data();
+    const float* b = divergence.Channels[0].data();
+    const float* solid = obstacles.Channels[0].data();
+    float* out = dest.Channels[0].data();
+
+    auto scalar = [&](int x, int y, int z, bool edge) {
+        Neighbours n = Around(g, x, y, z, edge);
+        float pC = p[n.C];
+        float pN = solid[n.N] > 0 ? pC : p[n.N];
+        float pS = solid[n.S] > 0 ? pC : p[n.S];
+        float pE = solid[n.E] > 0 ? pC : p[n.E];
+        float pW = solid[n.W] > 0 ? pC : p[n.W];
+        float pU = solid[n.U] > 0 ? pC : p[n.U];
+        float pD = solid[n.D] > 0 ? pC : p[n.D];
+        float pJ = (pW + pE + pS + pN + pU + pD + alpha * b[n.C]) * inverseBeta;
+        out[n.C] = pC + omega * (pJ - pC);
+    };
+
+    auto vector = [&](int x, int y, int z) {
+#ifdef __AVX2__
+        const __m256 a = _mm256_set1_ps(alpha);
+        const __m256 ib = _mm256_set1_ps(inverseBeta);
+        const __m256 w = _mm256_set1_ps(omega);
+
+        for (; x + 8 <= g.W - 1; x += 8)
+        {
+            ptrdiff_t i = g.at(x, y, z);
+            __m256 pC = _mm256_loadu_ps(p + i);
+            __m256 sum = Neighbour(p, solid, i - 1, pC);
+            sum = _mm256_add_ps(sum, Neighbour(p, solid, i + 1, pC));
+            sum = _mm256_add_ps(sum, Neighbour(p, solid, i - g.Row, pC));
+            sum = _mm256_add_ps(sum, Neighbour(p, solid, i + g.Row, pC));
+            sum = _mm256_add_ps(sum, Neighbour(p, solid, i + g.Slice, pC));
+            sum = _mm256_add_ps(sum, Neighbour(p, solid, i - g.Slice, pC));
+            __m256 pJ = _mm256_mul_ps(_mm256_fmadd_ps(a, _mm256_loadu_ps(b + i), sum), ib);
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(w, _mm256_sub_ps(pJ, pC), pC));
+        }
+#endif
+        return x;
+    };
+
+    ForEachSlab(g.D, [&](int z0, int z1) { StencilRows(g, z0, z1, scalar, vector); });
+}
+
+void SubtractGradient(const CpuSurfacePod& velocity, const CpuSurfacePod& pressure, const CpuSurfacePod& obstacles, CpuSurfacePod& dest)
+{
+    Grid g(dest);
+
+    const float* vx = velocity.Channels[0].data();
+    const float* vy = velocity.Channels[1].data();
+    const float* vz = velocity.Channels[2].data();
+    const float* p = pressure.Channels[0].data();
+    const float* solid = obstacles.Channels[0].data();
+    float* outX = dest.Channels[0].data();
+    float* outY = dest.Channels[1].data();
+    float* outZ = dest.Channels[2].data();
+
+    // Follows subtract-gradient.frag exactly so the two can be compared field
+    // for field. Obstacles are static, so solid voxels and faces get no velocity.
+    auto scalar = [&](int x, int y, int z, bool edge) {
+        Neighbours n = Around(g, x, y, z, edge);
+        if (solid[n.C] > 0)
+        {
+            outX[n.C] = outY[n.C] = outZ[n.C] = 0;
+            return;
+        }
+
+        float pC = p[n.C];
+        float pN = p[n.N], pS = p[n.S], pE = p[n.E], pW = p[n.W], pU = p[n.U], pD = p[n.D];
+        float maskX = 1, maskY = 1, maskZ = 1;
+
+        if (solid[n.N] > 0) { pN = pC; maskY = 0; }
+        if (solid[n.S] > 0) { pS = pC; maskY = 0; }
+        if (solid[n.E] > 0) { pE = pC; maskX = 0; }
+        if (solid[n.W] > 0) { pW = pC; maskX = 0; }
+        if (solid[n.U] > 0) { pU = pC; maskZ = 0; }
+        if (solid[n.D] > 0) { pD = pC; maskZ = 0; }
+
+        outX[n.C] = maskX * (vx[n.C] - (pE - pW) * GradientScale);
+        outY[n.C] = maskY * (vy[n.C] - (pN - pS) * GradientScale);
+        outZ[n.C] = maskZ * (vz[n.C] - (pU - pD) * GradientScale);
+    };
+
+    auto vector = [&](int x, int y, int z) {
+#ifdef __AVX2__
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 scale = _mm256_set1_ps(GradientScale);
+
+        for (; x + 8 <= g.W - 1; x += 8)
+        {
+            ptrdiff_t i = g.at(x, y, z);
+            __m256 pC = _mm256_loadu_ps(p + i);
+
+            __m256 sN = IsSolid(solid, i + g.Row), sS = IsSolid(solid, i - g.Row);
+            __m256 sE = IsSolid(solid, i + 1), sW = IsSolid(solid, i - 1);
+            __m256 sU = IsSolid(solid, i + g.Slice), sD = IsSolid(solid, i - g.Slice);
+
+            __m256 pN = _mm256_blendv_ps(_mm256_loadu_ps(p + i + g.Row), pC, sN);
+            __m256 pS = _mm256_blendv_ps(_mm256_loadu_ps(p + i - g.Row), pC, sS);
+            __m256 pE = _mm256_blendv_ps(_mm256_loadu_ps(p + i + 1), pC, sE);
+            __m256 pW = _mm256_blendv_ps(_mm256_loadu_ps(p + i - 1), pC, sW);
+            __m256 pU = _mm256_blendv_ps(_mm256_loadu_ps(p + i + g.Slice), pC, sU);
+            __m256 pD = _mm256_blendv_ps(_mm256_loadu_ps(p + i - g.Slice), pC, sD);
+
+            __m256 newX = _mm256_fnmadd_ps(_mm256_sub_ps(pE, pW), scale, _mm256_loadu_ps(vx + i));
+            __m256 newY = _mm256_fnmadd_ps(_mm256_sub_ps(pN, pS), scale, _mm256_loadu_ps(vy + i));
+            __m256 newZ = _mm256_fnmadd_ps(_mm256_sub_ps(pU, pD), scale, _mm256_loadu_ps(vz + i));
+
+            // Solid voxels, and components facing a solid neighbour, are zeroed
+            __m256 sC = IsSolid(solid, i);
+            _mm256_storeu_ps(outX + i, _mm256_blendv_ps(newX, zero, _mm256_or_ps(sC, _mm256_or_ps(sE, sW))));
+            _mm256_storeu_ps(outY + i, _mm256_blendv_ps(newY, zero, _mm256_or_ps(sC, _mm256_or_ps(sN, sS))));
+            _mm256_storeu_ps(outZ + i, _mm256_blendv_ps(newZ, zero, _mm256_or_ps(sC, _mm256_or_ps(sU, sD))));
+        }
+#endif
+        return x;
+    };
+
+    ForEachSlab(g.D, [&](int z0, int z1) { StencilRows(g, z0, z1, scalar, vector); });
+}
+
+void ComputeDivergence(const CpuSurfacePod& velocity, const CpuSurfacePod& obstacles, CpuSurfacePod& dest)
+{
+    Grid g(dest);
+    float halfInverseCellSize = 0.5f / CellSize;
+
+    const float* vx = velocity.Channels[0].data();
+    const float* vy = velocity.Channels[1].data();
+    const float* vz = velocity.Channels[2].data();
+    const float* solid = obstacles.Channels[0].data();
+    float* out = dest.Channels[0].data();
+
+    // Solid neighbours are static and contribute no velocity, as in divergence.frag
+    auto scalar = [&](int x, int y, int z, bool edge) {
+        Neighbours n = Around(g, x, y, z, edge);
+        float vE = solid[n.E] > 0 ? 0 : vx[n.E];
+        float vW = solid[n.W] > 0 ? 0 : vx[n.W];
+        float vN = solid[n.N] > 0 ? 0 : vy[n.N];
+        float vS = solid[n.S] > 0 ? 0 : vy[n.S];
+        float vU = solid[n.U] > 0 ? 0 : vz[n.U];
+        float vD = solid[n.D] > 0 ? 0 : vz[n.D];
+        out[n.C] = halfInverseCellSize * (vE - vW + vN - vS + vU - vD);
+    };
+
+    auto vector = [&](int x, int y, int z) {
+#ifdef __AVX2__
+        const __m256 h = _mm256_set1_ps(halfInverseCellSize);
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (; x + 8 <= g.W - 1; x += 8)
+        {
+            ptrdiff_t i = g.at(x, y, z);
+            __m256 vE = Neighbour(vx, solid, i + 1, zero);
+            __m256 vW = Neighbour(vx, solid, i - 1, zero);
+            __m256 vN = Neighbour(vy, solid, i + g.Row, zero);
+            __m256 vS = Neighbour(vy, solid, i - g.Row, zero);
+            __m256 vU = Neighbour(vz, solid, i + g.Slice, zero);
+            __m256 vD = Neighbour(vz, solid, i - g.Slice, zero);
+
+            __m256 sum = _mm256_add_ps(_mm256_sub_ps(vE, vW), _mm256_sub_ps(vN, vS));
+            sum = _mm256_add_ps(sum, _mm256_sub_ps(vU, vD));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(h, sum));
+        }
+#endif
+        return x;
+    };
+
+    ForEachSlab(g.D, [&](int z0, int z1) { StencilRows(g, z0, z1, scalar, vector); });
+}
+
+void ApplyImpulse(CpuSurfacePod& dest, glm::vec3 position, float value)
+{
+    Grid g(dest);
+    float radius = GetSimulationSettings().SplatRadius;
+
+    // Blended the way the GPU pass is, with alpha falling off towards the rim
+    int zMin = std::max(0, int(position.z - radius)), zMax = std::min(g.D, int(position.z + radius) + 1);
+    int yMin = std::max(0, int(position.y - radius)), yMax = std::min(g.H, int(position.y + radius) + 1);
+    int xMin = std::max(0, int(position.x - radius)), xMax = std::min(g.W, int(position.x + radius) + 1);
+
+    if (zMin >= zMax)
+    {
+        return;
+    }
+
+    // Only the slabs the splat covers are handed out
+    ForEachSlab(zMax - zMin, [&](int z0, int z1) {
+        for (int z = zMin + z0; z < zMin + z1; ++z)
+        {
+            for (int y = yMin; y < yMax; ++y)
+            {
+                for (int x = xMin; x < xMax; ++x)
+                {
+                    float d = glm::distance(position, glm::vec3(x + 0.5f, y + 0.5f, z + 0.5f));
+                    if (d >= radius)
+                    {
+                        continue;
+                    }
+
+                    float a = std::min((radius - d) * 0.5f, 1.0f);
+                    for (int c = 0; c < dest.Components; ++c)
+                    {
+                        float& v = dest.Channels[c][g.at(x, y, z)];
+                        v = value * a + v * (1 - a);
+                    }
+                }
+            }
+        }
+    });
+}
+
+void ApplyBuoyancy(const CpuSurfacePod& velocity, const CpuSurfacePod& temperature, const CpuSurfacePod& density, CpuSurfacePod& dest)
+{
+    Grid g(dest);
+    float timeStep = GetSimulationSettings().TimeStep;
+
+    ForEachSlab(g.D, [&](int z0, int z1) {
+        size_t begin = size_t(z0) * g.Slice;
+        size_t end = size_t(z1) * g.Slice;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            float t = temperature.Channels[0][i];
+            float lift = 0;
+            if (t > AmbientTemperature)
+            {
+                lift = timeStep * (t - AmbientTemperature) * SmokeBuoyancy - density.Channels[0][i] * SmokeWeight;
+            }
+
+            dest.Channels[0][i] = velocity.Channels[0][i];
+            dest.Channels[1][i] = velocity.Channels[1][i] - lift;
+            dest.Channels[2][i] = velocity.Channels[2][i];
+        }
+    });
+}
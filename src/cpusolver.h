@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "utility.h"
+
+// CPU mirror of the GPU solver for machines without a GPU and for checking the
+// shaders against. Volumes are kept as one float array per component, and
+// every pass is split into z slabs across a pool of worker threads. Only the
+// stencil passes (Jacobi, divergence and gradient subtraction) have AVX2 paths
+// when the compiler targets it; advection, buoyancy and the impulse are scalar.
+struct CpuSurfacePod {
+    int Width;
+    int Height;
+    int Depth;
+    int Components;
+    std::vector<float> Channels[4];
+};
+
+struct CpuSlabPod {
+    CpuSurfacePod Ping;
+    CpuSurfacePod Pong;
+};
+
+CpuSlabPod CreateCpuSlab(int width, int height, int depth, int numComponents);
+CpuSurfacePod CreateCpuVolume(int width, int height, int depth, int numComponents);
+void CreateObstacles(CpuSurfacePod& dest);
+void UploadVolume(const CpuSurfacePod& source, SurfacePod dest);
+
+void SwapSurfaces(CpuSlabPod* slab);
+void ClearSurface(CpuSurfacePod& s, float v);
+void Advect(const CpuSurfacePod& velocity, const CpuSurfacePod& source, const CpuSurfacePod& obstacles, CpuSurfacePod& dest, float dissipation);
+void Jacobi(const CpuSurfacePod& pressure, const CpuSurfacePod& divergence, const CpuSurfacePod& obstacles, CpuSurfacePod& dest, float cellSize, float omega);
+void SubtractGradient(const CpuSurfacePod& velocity, const CpuSurfacePod& pressure, const CpuSurfacePod& obstacles, CpuSurfacePod& dest);
+void ComputeDivergence(const CpuSurfacePod& velocity, const CpuSurfacePod& obstacles, CpuSurfacePod& dest);
+void ApplyImpulse(CpuSurfacePod& dest, glm::vec3 position, float value);
+void ApplyBuoyancy(const CpuSurfacePod& velocity, const CpuSurfacePod& temperature, const CpuSurfacePod& density, CpuSurfacePod& dest);
@@ -0,0 +1,200 @@
+#include "governor.h"
+
+#include <algorithm>
+
+const int MinJacobiIterations = 8;
+const int MinViewSamples = 32;
+const int MinLightSamples = 16;
+const int MaxLightCacheInterval = 8;
+const int MinGridSize = 32;
+
+// Frames to wait after a change before judging it. Resizing the grid throws
+// away the smoke, so it gets a much longer settling time.
+const int KnobCooldown = 30;
+const int GridCooldown = 120;
+
+static int Shrink(int value, int floor)
+{
+    return std::max(floor, value * 3 / 4);
+}
+
+static int Grow(int value, int ceiling)
+{
+    return std::min(ceiling, std::max(value + 1, value * 4 / 3));
+}
+
+// Grid dimensions stay on whole bricks so the solver's brick mask lines up
+static GLsizei ShrinkGrid(GLsizei value)
+{
+    return std::max(MinGridSize, value * 3 / 4 / 8 * 8);
+}
+
+static GLsizei GrowGrid(GLsizei value, GLsizei ceiling)
+{
+    return std::min(ceiling, (value * 4 / 3 + 7) / 8 * 8);
+}
+
+void QualityGovernor::setCeiling(const QualityKnobs& knobs)
+{
+    ceiling = knobs;
+}
+
+bool QualityGovernor::update(const StageCosts& costs, QualityKnobs& knobs)
+{
+    // Stages that only run every few frames spike in some frames and cost
+    // nothing in others, so each is judged by its running average
+    float total = costs.Solver + costs.Lighting + costs.Raycast;
+    bool first = smoothed == 0;
+    smoothed = first ? total : smoothed + 0.1f * (total - smoothed);
+    average.Solver = first ? costs.Solver : average.Solver + 0.1f * (costs.Solver - average.Solver);
+    average.Lighting = first ? costs.Lighting : average.Lighting + 0.1f * (costs.Lighting - average.Lighting);
+    average.Raycast = first ? costs.Raycast : average.Raycast + 0.1f * (costs.Raycast - average.Raycast);
+
+    if (!Enabled)
+    {
+        return false;
+    }
+
+    if (cooldown > 0)
+    {
+        --cooldown;
+        return false;
+    }
+
+    // The gap between the two thresholds keeps it from flip-flopping around the target
+    if (smoothed > TargetMs * 1.1f)
+    {
+        return degrade(average, knobs);
+    }
+
+    if (smoothed < TargetMs * 0.75f)
+    {
+        return upgrade(knobs, smoothed < TargetMs * 0.5f);
+    }
+
+    return false;
+}
+
+bool QualityGovernor::degrade(const StageCosts& costs, QualityKnobs& knobs)
+{
+    enum { Solver, Lighting, Raycast };
+    std::pair<float, int> stages[] = {
+        { costs.Solver, Solver },
+        { costs.Lighting, Lighting },
+        { costs.Raycast, Raycast },
+    };
+    std::sort(stages, stages + 3, [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return a.first > b.first;
+    });
+
+    // Cheapen the most expensive stage first, falling through to the next one
+    // once every knob of a stage has hit its floor
+    for (auto& stage : stages)
+    {
+        switch (stage.second)
+        {
+            case Solver:
+                if (IterativeSolver && knobs.JacobiIterations > MinJacobiIterations)
+                {
+                    int next = Shrink(knobs.JacobiIterations, MinJacobiIterations);
+                    record("Jacobi iterations", knobs.JacobiIterations, next, KnobCooldown);
+                    knobs.JacobiIterations = next;
+                    return true;
+                }
+                if (knobs.GridWidth > MinGridSize || knobs.GridHeight > MinGridSize || knobs.GridDepth > MinGridSize)
+                {
+                    GLsizei next = ShrinkGrid(knobs.GridWidth);
+                    record("Grid width", knobs.GridWidth, next, GridCooldown);
+                    knobs.GridWidth = next;
+                    knobs.GridHeight = ShrinkGrid(knobs.GridHeight);
+                    knobs.GridDepth = ShrinkGrid(knobs.GridDepth);
+                    return true;
+                }
+                break;
+
+            case Lighting:
+                if (knobs.LightCacheInterval < MaxLightCacheInterval)
+                {
+                    int next = knobs.LightCacheInterval * 2;
+                    record("Light cache interval", knobs.LightCacheInterval, next, KnobCooldown);
+                    knobs.LightCacheInterval = next;
+                    return true;
+                }
+                if (!SweptLighting && knobs.LightSamples > MinLightSamples)
+                {
+                    int next = Shrink(knobs.LightSamples, MinLightSamples);
+                    record("Light samples", knobs.LightSamples, next, KnobCooldown);
+                    knobs.LightSamples = next;
+                    return true;
+                }
+                break;
+
+            case Raycast:
+                if (knobs.ViewSamples > MinViewSamples)
+                {
+                    int next = Shrink(knobs.ViewSamples, MinViewSamples);
+                    record("View samples", knobs.ViewSamples, next, KnobCooldown);
+                    knobs.ViewSamples = next;
+                    return true;
+                }
+                break;
+        }
+    }
+
+    decision = "Every knob is at its floor";
+    return false;
+}
+
+bool QualityGovernor::upgrade(QualityKnobs& knobs, bool allowGrid)
+{
+    // Resolution is the biggest jump in cost, so only restore it with plenty of headroom
+    if (allowGrid && (knobs.GridWidth < ceiling.GridWidth || knobs.GridHeight < ceiling.GridHeight || knobs.GridDepth < ceiling.GridDepth))
+    {
+        GLsizei next = GrowGrid(knobs.GridWidth, ceiling.GridWidth);
+        record("Grid width", knobs.GridWidth, next, GridCooldown);
+        knobs.GridWidth = next;
+        knobs.GridHeight = GrowGrid(knobs.GridHeight, ceiling.GridHeight);
+        knobs.GridDepth = GrowGrid(knobs.GridDepth, ceiling.GridDepth);
+        return true;
+    }
+
+    if (IterativeSolver && knobs.JacobiIterations < ceiling.JacobiIterations)
+    {
+        int next = Grow(knobs.JacobiIterations, ceiling.JacobiIterations);
+        record("Jacobi iterations", knobs.JacobiIterations, next, KnobCooldown);
+        knobs.JacobiIterations = next;
+        return true;
+    }
+
+    if (knobs.ViewSamples < ceiling.ViewSamples)
+    {
+        int next = Grow(knobs.ViewSamples, ceiling.ViewSamples);
+        record("View samples", knobs.ViewSamples, next, KnobCooldown);
+        knobs.ViewSamples = next;
+        return true;
+    }
+
+    if (!SweptLighting && knobs.LightSamples < ceiling.LightSamples)
+    {
+        int next = Grow(knobs.LightSamples, ceiling.LightSamples);
+        record("Light samples", knobs.LightSamples, next, KnobCooldown);
+        knobs.LightSamples = next;
+        return true;
+    }
+
+    if (knobs.LightCacheInterval > ceiling.LightCacheInterval)
+    {
+        int next = std::max(ceiling.LightCacheInterval, knobs.LightCacheInterval / 2);
+        record("Light cache interval", knobs.LightCacheInterval, next, KnobCooldown);
+        knobs.LightCacheInterval = next;
+        return true;
+    }
+
+    return false;
+}
+
+void QualityGovernor::record(const char* knob, int from, int to, int cooldownFrames)
+{
+    decision = std::string(knob) + " " + std::to_string(from) + " -> " + std::to_string(to);
+    cooldown = cooldownFrames;
+}
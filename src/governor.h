@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+
+// The quality settings the governor is allowed to trade for frame time.
+struct QualityKnobs {
+    int JacobiIterations;
+    int ViewSamples;
+    int LightSamples;
+    int LightCacheInterval;     // regenerate the light cache every N frames
+    GLsizei GridWidth;
+    GLsizei GridHeight;
+    GLsizei GridDepth;
+};
+
+// GPU milliseconds spent in each group of stages during the last frame. A
+// stage that didn't run in it counts as zero.
+struct StageCosts {
+    float Solver;
+    float Lighting;
+    float Raycast;
+};
+
+// Holds a target GPU frame time by stepping one knob at a time. Over budget,
+// it degrades whichever knob belongs to the most expensive stage. Well under
+// budget, it restores quality back towards the ceiling the user picked.
+class QualityGovernor
+{
+public:
+    bool Enabled = false;
+    float TargetMs = 1000.0f / 60.0f;
+
+    // False while the pressure solver ignores JacobiIterations (multigrid runs
+    // a fixed number of V-cycles), so that knob is left alone
+    bool IterativeSolver = true;
+
+    // True while the light cache is swept slice by slice, which takes no
+    // LightSamples, so that knob is left alone too
+    bool SweptLighting = false;
+
+    // The best quality the governor may restore to
+    void setCeiling(const QualityKnobs& knobs);
+
+    // Returns true when it changed one of the knobs
+    bool update(const StageCosts& costs, QualityKnobs& knobs);
+
+    float smoothedMs() const { return smoothed; };
+    const std::string& lastDecision() const { return decision; };
+
+private:
+    bool degrade(const StageCosts& costs, QualityKnobs& knobs);
+    bool upgrade(QualityKnobs& knobs, bool allowGrid);
+    void record(const char* knob, int from, int to, int cooldownFrames);
+
+    QualityKnobs ceiling = {};
+    float smoothed = 0;
+    StageCosts average = {};
+    int cooldown = 0;
+    std::string decision = "Holding";
+};
@@ -1,4 +1,6 @@
 ﻿#include <iostream>
+#include <cstring>
+#include <cstdlib>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -21,19 +23,194 @@ int main(int argc, char *argv[])
     }
 
     Smokem smokem;
+    Config cfg = smokem.getConfig();
+
+    int benchmarkSteps = 0;
+    bool benchmarkRender = false;
+    bool useEgl = false;
+    const char* csvPath = NULL;
+    const char* recordDir = NULL;
+    const char* compareDir = NULL;
+    int regressionSteps = 50;
+    double tolerance = 1e-3;
+    bool halfVelocity = false;
+    const char* solverName = NULL;
+    const char* advectionName = NULL;
+    bool dense = false;
+    bool allIterations = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--compute") == 0)
+        {
+            cfg.Backend = SolverBackend::Compute;
+        }
+        else if (strcmp(argv[i], "--cpu") == 0)
+        {
+            cfg.Backend = SolverBackend::Cpu;
+        }
+        else if (strcmp(argv[i], "--half-velocity") == 0)
+        {
+            halfVelocity = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+        {
+            benchmarkSteps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--render") == 0)
+        {
+            benchmarkRender = true;
+        }
+        else if (strcmp(argv[i], "--egl") == 0)
+        {
+            useEgl = true;
+        }
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+        {
+            csvPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            recordDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+        {
+            compareDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+        {
+            regressionSteps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc)
+        {
+            solverName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--advection") == 0 && i + 1 < argc)
+        {
+            advectionName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--dense") == 0)
+        {
+            dense = true;
+        }
+        else if (strcmp(argv[i], "--all-iterations") == 0)
+        {
+            allIterations = true;
+        }
+    }
+
+    // Anything not given on the command line keeps the interactive defaults
+    SolverOptions options = smokem.getSolverOptions();
+    if (solverName)
+    {
+        if (strcmp(solverName, "jacobi") == 0) options.Pressure = JacobiSolver;
+        else if (strcmp(solverName, "sor") == 0) options.Pressure = RedBlackSORSolver;
+        else if (strcmp(solverName, "multigrid") == 0) options.Pressure = MultigridSolver;
+        else
+        {
+            printf("Unknown pressure solver '%s', expected jacobi, sor or multigrid.\n", solverName);
+            glfwTerminate();
+            return -1;
+        }
+    }
+    if (advectionName)
+    {
+        options.FuseAdvection = strcmp(advectionName, "fused") == 0;
+        options.MacCormackAdvection = strcmp(advectionName, "maccormack") == 0;
+        if (!options.FuseAdvection && !options.MacCormackAdvection && strcmp(advectionName, "separate") != 0)
+        {
+            printf("Unknown advection '%s', expected fused, separate or maccormack.\n", advectionName);
+            glfwTerminate();
+            return -1;
+        }
+    }
+    if (dense)
+    {
+        options.SparseDomain = false;
+    }
+    if (allIterations)
+    {
+        options.EarlyExit = false;
+    }
+
+    // Benchmarks and regression runs never show their window, and can skip the window system's GL entirely with EGL
+    bool regression = recordDir || compareDir;
+    bool benchmark = benchmarkSteps > 0;
+    if (benchmark || regression)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+
+    if (useEgl)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    }
+
+    // Compute shaders and image load/store need a 4.3 context
+    bool compute = cfg.Backend == SolverBackend::Compute;
 
     glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // The raycast blits this depth into a DEPTH24_STENCIL8 texture, which needs matching formats
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, compute ? 4 : 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 
-    GLFWwindow* window = glfwCreateWindow(smokem.getConfig().Width, smokem.getConfig().Height, smokem.getConfig().Title, NULL, NULL);
+    GLFWwindow* window = glfwCreateWindow(cfg.Width, cfg.Height, cfg.Title, NULL, NULL);
+    if (!window && compute)
+    {
+        printf("Could not create an OpenGL 4.3 context, falling back to the fragment solver.\n");
+        cfg.Backend = SolverBackend::Fragment;
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(cfg.Width, cfg.Height, cfg.Title, NULL, NULL);
+    }
+
+    if (!window)
+    {
+        glfwTerminate();
+        return -1;
+    }
+
     glfwMakeContextCurrent(window);
     //glfwSetCursorPosCallback(window, PezCursorCallback);
 
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
-    glfwSwapInterval(1);
+    glfwSwapInterval(benchmark || regression ? 0 : 1);
+
+    smokem.setConfig(cfg);
 
     smokem.initialize(window);
+    smokem.setSolverOptions(options);
+
+    if (halfVelocity)
+    {
+        SimulationSettings settings = smokem.getSimulationSettings();
+        settings.VelocityDownsample = 2;
+        smokem.setSimulationSettings(settings);
+    }
+
+    if (benchmark || regression)
+    {
+        int result = 0;
+        if (regression)
+        {
+            result = smokem.regression(regressionSteps, recordDir ? recordDir : compareDir, recordDir != NULL, tolerance);
+        }
+        else
+        {
+            smokem.benchmark(benchmarkSteps, benchmarkRender, csvPath);
+        }
+        smokem.exit();
+
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return result;
+    }
 
     auto previousTime = GetMicroseconds();
 
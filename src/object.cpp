@@ -65,6 +65,14 @@ void Object::render(GLuint programID, bool useMaterial)
     }
 }
 
+void Object::renderInstanced(GLsizei instances)
+{
+    for (auto& shape : mShapes)
+    {
+        shape.renderInstanced(instances);
+    }
+}
+
 void Object::setRotation(glm::vec3 rotation)
 {
     mRotate = mInitialRotate + rotation;
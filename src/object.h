@@ -22,6 +22,7 @@ public:
     ~Object();
 
     void render(GLuint programID, bool useMaterial = true);
+    void renderInstanced(GLsizei instances);
 
     void setRotation(glm::vec3 rotation);
     void setTranslation(glm::vec3 translation);
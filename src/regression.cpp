@@ -0,0 +1,93 @@
+#include "regression.h"
+
+#include <cmath>
+#include <cstdio>
+
+FieldData ReadField(SurfacePod surface, int components)
+{
+    FieldData field;
+    field.Width = surface.Width;
+    field.Height = surface.Height;
+    field.Depth = surface.Depth;
+    field.Components = components;
+    field.Values.resize(size_t(surface.Width) * surface.Height * surface.Depth * components);
+
+    // Asking for fewer channels than the texture has drops the compute backend's padding
+    const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_3D, surface.ColorTexture);
+    glGetTexImage(GL_TEXTURE_3D, 0, formats[components - 1], GL_FLOAT, field.Values.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    return field;
+}
+
+// Fields are stored as four ints (width, height, depth, components) followed
+// by the raw floats, in whatever byte order the machine that recorded them uses.
+bool SaveField(const std::string& path, const FieldData& field)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        printf("Could not write %s\n", path.c_str());
+        return false;
+    }
+
+    int header[4] = { field.Width, field.Height, field.Depth, field.Components };
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(field.Values.data(), sizeof(float), field.Values.size(), file);
+    fclose(file);
+    return true;
+}
+
+bool LoadField(const std::string& path, FieldData& field)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        printf("Could not read %s\n", path.c_str());
+        return false;
+    }
+
+    int header[4] = { 0, 0, 0, 0 };
+    bool ok = fread(header, sizeof(header), 1, file) == 1;
+
+    field.Width = header[0];
+    field.Height = header[1];
+    field.Depth = header[2];
+    field.Components = header[3];
+    field.Values.resize(size_t(field.Width) * field.Height * field.Depth * field.Components);
+
+    ok = ok && fread(field.Values.data(), sizeof(float), field.Values.size(), file) == field.Values.size();
+    fclose(file);
+
+    if (!ok)
+    {
+        printf("%s is truncated\n", path.c_str());
+    }
+    return ok;
+}
+
+FieldError CompareFields(const FieldData& actual, const FieldData& expected, double tolerance)
+{
+    FieldError error = { 0, 0, false };
+
+    if (actual.Width != expected.Width || actual.Height != expected.Height ||
+        actual.Depth != expected.Depth || actual.Components != expected.Components)
+    {
+        error.L2 = error.Max = HUGE_VAL;
+        return error;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < actual.Values.size(); ++i)
+    {
+        double d = std::abs(double(actual.Values[i]) - expected.Values[i]);
+        sum += d * d;
+        error.Max = std::max(error.Max, d);
+    }
+
+    error.L2 = actual.Values.empty() ? 0 : std::sqrt(sum / actual.Values.size());
+    error.Passed = error.L2 <= tolerance;
+    return error;
+}
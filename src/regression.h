@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "utility.h"
+
+// A volume read back to the CPU as tightly packed floats.
+struct FieldData {
+    GLsizei Width;
+    GLsizei Height;
+    GLsizei Depth;
+    int Components;
+    std::vector<float> Values;
+};
+
+struct FieldError {
+    double L2;      // root mean square difference over every component
+    double Max;     // largest absolute difference
+    bool Passed;
+};
+
+FieldData ReadField(SurfacePod surface, int components);
+bool SaveField(const std::string& path, const FieldData& field);
+bool LoadField(const std::string& path, FieldData& field);
+FieldError CompareFields(const FieldData& actual, const FieldData& expected, double tolerance);
@@ -10,12 +10,46 @@ Shader::~Shader()
     if (mHandle > 0) glDeleteShader(mHandle);
 }
 
-GLuint Shader::loadShader(GLenum shaderType, const std::string& filename)
+// Reads a shader and splices in any '#include "file"' lines, which GLSL has
+// no notion of. Included paths are relative to the file naming them, and a
+// #line after each one keeps compile errors pointing at the right line.
+static bool readShaderSource(const std::string& filename, std::string& text)
 {
     std::ifstream shaderFile(filename);
-    if (!shaderFile.is_open()) return 0;
+    if (!shaderFile.is_open()) return false;
+
+    std::string directory = filename.substr(0, filename.find_last_of('/') + 1);
+    std::string line;
+    int lineNumber = 0;
+
+    while (std::getline(shaderFile, line))
+    {
+        ++lineNumber;
+
+        if (line.compare(0, 9, "#include ") != 0)
+        {
+            text += line + "\n";
+            continue;
+        }
+
+        size_t open = line.find('"');
+        size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (close == std::string::npos || !readShaderSource(directory + line.substr(open + 1, close - open - 1), text))
+        {
+            printf("Shader include error in %s:%d: %s\n", filename.c_str(), lineNumber, line.c_str());
+            exit(1);
+        }
+
+        text += "#line " + std::to_string(lineNumber + 1) + "\n";
+    }
 
-    std::string shaderText(static_cast<const std::stringstream&>(std::stringstream() << shaderFile.rdbuf()).str());
+    return true;
+}
+
+GLuint Shader::loadShader(GLenum shaderType, const std::string& filename)
+{
+    std::string shaderText;
+    if (!readShaderSource(filename, shaderText)) return 0;
 
     auto shader = glCreateShader(shaderType);
     if (shader == 0) return 0;
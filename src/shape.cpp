@@ -132,6 +132,14 @@ void Shape::render(GLuint programID, bool useMaterial)
     glDrawElements(GL_TRIANGLES, mIndicesSize, GL_UNSIGNED_INT, 0);
 }
 
+// Draws the bare geometry with whatever program is bound, for passes that
+// need positions only.
+void Shape::renderInstanced(GLsizei instances)
+{
+    glBindVertexArray(mVertexVaoHandle);
+    glDrawElementsInstanced(GL_TRIANGLES, mIndicesSize, GL_UNSIGNED_INT, 0, instances);
+}
+
 GLuint Shape::generateTexture(const char* filename, const unsigned int texCount)
 {
     GLuint texture = 0;
@@ -30,6 +30,7 @@ public:
     ~Shape();
 
     void render(GLuint programID, bool useMaterial);
+    void renderInstanced(GLsizei instances);
 
     unsigned int getVerticesSize() const { return mVerticesSize; };
     unsigned int getIndicesSize() const { return mIndicesSize; };
@@ -7,15 +7,83 @@ static Program* ModelProgram;
 static std::vector<Object*> objects;
 static std::vector<Light> lights;
 
-static glm::vec3 smokeTranslation(-10, 10, 20);
+// World-space corner and edge length of the box the simulation grid fills,
+// shared by the raycast and the obstacle voxelizer
+static glm::vec3 smokeTranslation(20, 0, 20);
+static const float VolumeSize = 8.0f;
 
 static Program* RaycastProgram;
 static Program* LightProgram;
+static Program* LightSweepProgram;
 static Program* BlurProgram;
+static Program* ResolveProgram;
+static Program* SceneDistanceProgram;
 
 static bool SimulateFluid = true;
-static int ViewSamples = GridWidth * 2;
-static int LightSamples = GridWidth;
+static bool FuseAdvection = true;
+static bool MacCormackAdvection = false;
+static float VorticityStrength = 0.0f;
+static int PressureMethod = MultigridSolver;
+static bool EarlyExit = true;
+static float SorOmega = 1.7f;
+static float PressureTolerance = 0.001f;
+static int PressureIterations = 0;
+static float CpuStepMs = 0;
+static float PressureResidual = 0;
+static int SimulationStep = 0;              // tags residual checks, which come back a few steps late
+static int CheckedStep = -1;                // newest step a residual check has come back from
+static int CheckedIterations = -1;          // iterations that step took to reach the tolerance, -1 if it didn't
+static bool ReportResidual = false;         // measure the multigrid residual, while it's shown or benchmarked
+static bool SparseDomain = true;
+static float SparseThreshold = BrickThreshold;
+static int ViewSamples = 256;
+static int LightSamples = 128;
+static int LightCacheInterval = 1;
+static bool SweepLightCache = true;         // propagate slice by slice instead of marching every voxel
+static bool AmortizeLightCache = false;     // spread each refresh over LightCacheInterval frames
+static GLuint LightSweepFbo;
+
+static float SmokeAbsorption = 10.0f;
+static int BlurRadius = 2;                  // of the separable density blur, in voxels
+static const int MaxBlurRadius = 6;         // as in shaders/light/blur.glsl
+static bool FuseBlur = true;                // do the last blur pass inside the light sweep
+static const int MaxLights = 8;             // what model.frag has room for
+static const int LightBatchSize = 4;        // as in shaders/light/light-batch.glsl
+
+// Everything the light cache is computed from besides the density
+struct LightCacheInputs {
+    std::vector<glm::vec3> Lights;  // position in volume coordinates and smoke colour of each light
+    float Absorption;
+    bool Sweep;
+    int Samples;                    // only used by the march
+};
+
+static LightCacheInputs CachedLight;
+
+// Lights that sweep the volume the same way, drawn together in one pass
+struct LightBatch {
+    int Axis;
+    int Direction;
+    GLsizei Slices;
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::vec3> Colors;
+};
+
+// The blur, its pyramid and the light cache only change with the density, so
+// they are rebuilt when the solver steps or the inputs above change
+static bool DensityChanged = true;
+static int BlurredRadius = 0;
+static bool LightCacheDirty = true;
+static int LightCacheCursor = 0;            // slices of the current refresh already written
+static int FrameCount = 0;
+static int TemporalFrames = 1;      // spread the view samples over this many frames
+static int RaycastScale = 1;        // raycast at 1/N of the window resolution
+static glm::mat4 PreviousViewProjection;
+static bool HistoryValid = false;
+
+static GpuTimer Timer;
+static QualityGovernor Governor;
+static ObstacleVoxelizer Voxelizer;
 
 void Smokem::initialize(GLFWwindow* window)
 {
@@ -41,7 +109,18 @@ void Smokem::initialize(GLFWwindow* window)
         glm::vec3(0.1f), // ambient light
         glm::vec3(0.09f), // diffuse light
         glm::vec3(0.04f), // specular light
-        1000.0f // brightness
+        1000.0f, // brightness
+        glm::vec3(2.0f) // smoke lighting
+    });
+
+    // Low and to one side of the smoke, so it shows the shadowing
+    lights.push_back({
+        glm::vec3(28, 8, 36),
+        glm::vec3(0.0f),
+        glm::vec3(0.09f),
+        glm::vec3(0.04f),
+        50.0f,
+        glm::vec3(10.0f)
     });
 
     assert(checkError());
@@ -61,15 +140,51 @@ static struct {
     SlabPod Density;
     SlabPod Pressure;
     SlabPod Temperature;
+    SlabPod LightTransmittance;     // the light sweep alternates slices between the two
+    SlabPod LightCache;             // rendered from Ping while a refresh fills Pong
 } Slabs;
 
 static struct {
     SurfacePod Divergence;
     SurfacePod Obstacles;
-    SurfacePod LightCache;
+    SurfacePod VelocityObstacles;   // same as Obstacles unless velocity is downsampled
+    SurfacePod Walls;               // float volumes the flags are built from, without the scene objects
+    SurfacePod VelocityWalls;
+    SurfacePod Solid;               // walls plus scene objects
+    SurfacePod VelocitySolid;
+    SurfacePod ObstacleVelocity;
     SurfacePod BlurredDensity;
+    SurfacePod BlurScratch;         // between the separable blur's passes
+    SurfacePod Residual;
+    SurfacePod BrickActivity;
+    SurfacePod BrickMask;
+    SurfacePod DensityMax;          // max-density pyramid over the bricks, for empty space skipping
+    SurfacePod AdvectForward;
+    SurfacePod AdvectBackward;
+    SurfacePod ScalarForward;
+    SurfacePod ScalarBackward;
+    SurfacePod Vorticity;
 } Surfaces;
 
+static std::vector<MultigridLevel> Multigrid;
+
+// Only allocated once the raycast runs at a lower resolution or over several frames
+static struct {
+    SlabPod Smoke;              // premultiplied, ping-ponged as the temporal history
+    SurfacePod SceneDepth;      // single-sample copy of the window's depth buffer
+    SurfacePod SceneDistance;   // distance to the nearest model in each low resolution pixel
+} RaycastTargets;
+
+// Only allocated on the CPU backend, which uploads density for rendering
+static struct {
+    CpuSlabPod Velocity;
+    CpuSlabPod Density;
+    CpuSlabPod Pressure;
+    CpuSlabPod Temperature;
+    CpuSurfacePod Divergence;
+    CpuSurfacePod Obstacles;
+} CpuFields;
+
 static struct {
     GLuint CubeCenter;
     GLuint FullscreenQuad;
@@ -79,7 +194,7 @@ void Smokem::initSmoke()
 {
     RaycastProgram = new Program({
         Shader(GL_VERTEX_SHADER, "shaders/raycast/raycast.vert"),
-        Shader(GL_GEOMETRY_SHADER, "shaders/raycast/raycast.gs"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/raycast/proxy-box.gs"),
         Shader(GL_FRAGMENT_SHADER, "shaders/raycast/raycast.frag")
     });
 
@@ -89,12 +204,31 @@ void Smokem::initSmoke()
         Shader(GL_FRAGMENT_SHADER, "shaders/light/cache.frag")
     });
 
+    LightSweepProgram = new Program({
+        Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/light/sweep.frag")
+    });
+    glGenFramebuffers(1, &LightSweepFbo);
+
     BlurProgram = new Program({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
         Shader(GL_FRAGMENT_SHADER, "shaders/light/blur.frag")
     });
 
+    ResolveProgram = new Program({
+        Shader(GL_VERTEX_SHADER, "shaders/raycast/raycast.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/raycast/proxy-box.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/raycast/resolve.frag")
+    });
+
+    SceneDistanceProgram = new Program({
+        Shader(GL_VERTEX_SHADER, "shaders/raycast/raycast.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/raycast/raycast.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/raycast/scene-distance.frag")
+    });
+
     glGenVertexArrays(1, &Vaos.CubeCenter);
     glBindVertexArray(Vaos.CubeCenter);
     CreatePointVbo(0, 0, 0);
@@ -109,26 +243,320 @@ void Smokem::initSmoke()
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     
-    InitializeSlabPrograms();
-
-    Slabs.Velocity = CreateSlab(GridWidth, GridHeight, GridDepth, 3);
-    Slabs.Density = CreateSlab(GridWidth, GridHeight, GridDepth, 1);
-    Slabs.Pressure = CreateSlab(GridWidth, GridHeight, GridDepth, 1);
-    Slabs.Temperature = CreateSlab(GridWidth, GridHeight, GridDepth, 1);
+    InitializeSlabPrograms(getConfig().Backend);
+    SetSimulationSettings(settings);
 
-    Surfaces.Divergence = CreateVolume(GridWidth, GridHeight, GridDepth, 3);
-    Surfaces.LightCache = CreateVolume(GridWidth, GridHeight, GridDepth, 1);
-    Surfaces.BlurredDensity = CreateVolume(GridWidth, GridHeight, GridDepth, 1);
-    Surfaces.Obstacles = CreateVolume(GridWidth, GridHeight, GridDepth, 3);
+    Voxelizer.initialize();
+    for (auto obj : objects)
+    {
+        Voxelizer.add(obj);
+    }
 
-    CreateObstacles(Surfaces.Obstacles);
-    ClearSurface(Slabs.Temperature.Ping, AmbientTemperature);
+    createVolumes();
 
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
+void Smokem::createVolumes()
+{
+    GLsizei w = settings.GridWidth;
+    GLsizei h = settings.GridHeight;
+    GLsizei d = settings.GridDepth;
+
+    // Velocity, pressure and everything the projection touches can run on a coarser grid
+    GLsizei vw = w / settings.VelocityDownsample;
+    GLsizei vh = h / settings.VelocityDownsample;
+    GLsizei vd = d / settings.VelocityDownsample;
+
+    Slabs.Velocity = CreateSlab(vw, vh, vd, settings.VelocityFormat);
+    Slabs.Density = CreateSlab(w, h, d, settings.DensityFormat);
+    Slabs.Pressure = CreateSlab(vw, vh, vd, settings.PressureFormat);
+    Slabs.Temperature = CreateSlab(w, h, d, settings.TemperatureFormat);
+    Slabs.LightTransmittance = CreateSlab(w, h, d, LightBatchSize);
+    Slabs.LightCache = CreateSlab(w, h, d, 3);
+
+    Surfaces.Divergence = CreateVolumeWithFormat(vw, vh, vd, settings.PressureFormat);
+    Surfaces.BlurredDensity = CreateVolume(w, h, d, 1);
+    Surfaces.BlurScratch = CreateVolume(w, h, d, 1);
+    Surfaces.Obstacles = CreateVolumeWithFormat(w, h, d, GL_R8UI);
+    Surfaces.VelocityObstacles = settings.VelocityDownsample > 1 ? CreateVolumeWithFormat(vw, vh, vd, GL_R8UI) : Surfaces.Obstacles;
+    Surfaces.Residual = CreateVolumeWithFormat(vw, vh, vd, GL_RG32F);
+    Surfaces.AdvectForward = CreateVolume(vw, vh, vd, 3);
+    Surfaces.AdvectBackward = CreateVolume(vw, vh, vd, 3);
+    Surfaces.ScalarForward = CreateVolume(w, h, d, 1);
+    Surfaces.ScalarBackward = CreateVolume(w, h, d, 1);
+    Surfaces.Vorticity = CreateVolume(vw, vh, vd, 3);
+    // A single zero texel until a scene obstacle starts moving
+    Surfaces.ObstacleVelocity = CreateVolume(1, 1, 1, 3);
+    SetObstacleVelocity(Surfaces.ObstacleVelocity);
+
+    // One texel per brick, rounded up so partial bricks at the far edges are covered
+    GLsizei brickWidth = (w + BrickSize - 1) / BrickSize;
+    GLsizei brickHeight = (h + BrickSize - 1) / BrickSize;
+    GLsizei brickDepth = (d + BrickSize - 1) / BrickSize;
+    Surfaces.BrickActivity = CreateVolume(brickWidth, brickHeight, brickDepth, 1);
+    Surfaces.BrickMask = CreateVolume(brickWidth, brickHeight, brickDepth, 1);
+    ClearSurface(Surfaces.BrickMask, 1);
+    SetBrickMask(Surfaces.BrickMask);
+    Surfaces.DensityMax = CreateMipVolume(brickWidth, brickHeight, brickDepth);
+
+    Multigrid = CreateMultigrid(vw, vh, vd, NumMultigridLevels);
+
+    // Walls are drawn into 8-bit volumes once and kept, since scene objects
+    // moving through the grid rebuild the flags from them plus their own masks
+    bool split = settings.VelocityDownsample > 1;
+    Surfaces.Walls = CreateVolumeWithFormat(w, h, d, GL_R8);
+    Surfaces.VelocityWalls = split ? CreateVolumeWithFormat(vw, vh, vd, GL_R8) : Surfaces.Walls;
+    Surfaces.Solid = CreateVolumeWithFormat(w, h, d, GL_R8);
+    Surfaces.VelocitySolid = split ? CreateVolumeWithFormat(vw, vh, vd, GL_R8) : Surfaces.Solid;
+    CreateObstacles(Surfaces.Walls);
+    if (split)
+    {
+        CreateObstacles(Surfaces.VelocityWalls);
+    }
+    ClearSurface(Slabs.Temperature.Ping, AmbientTemperature);
+
+    glBindVertexArray(Vaos.FullscreenQuad);
+    BuildObstacleFlags(Surfaces.Walls, Surfaces.Obstacles);
+    if (split)
+    {
+        BuildObstacleFlags(Surfaces.VelocityWalls, Surfaces.VelocityObstacles);
+    }
+    RestrictObstacles(Surfaces.VelocityWalls, Multigrid);
+
+    // The flags above only hold the walls, so put the scene objects back next step
+    Voxelizer.invalidate();
+
+    if (GetSolverBackend() == SolverBackend::Cpu)
+    {
+        CpuFields.Velocity = CreateCpuSlab(w, h, d, 3);
+        CpuFields.Density = CreateCpuSlab(w, h, d, 1);
+        CpuFields.Pressure = CreateCpuSlab(w, h, d, 1);
+        CpuFields.Temperature = CreateCpuSlab(w, h, d, 1);
+        CpuFields.Divergence = CreateCpuVolume(w, h, d, 1);
+        CpuFields.Obstacles = CreateCpuVolume(w, h, d, 1);
+
+        CreateObstacles(CpuFields.Obstacles);
+        ClearSurface(CpuFields.Temperature.Ping, AmbientTemperature);
+    }
+
+    ViewSamples = w * 2;
+    LightSamples = w;
+
+    DensityChanged = true;
+    LightCacheCursor = 0;
+    ClearSurface(Slabs.LightCache.Ping, 0);
+}
+
+void Smokem::destroyVolumes()
+{
+    DestroySlab(Slabs.Velocity);
+    DestroySlab(Slabs.Density);
+    DestroySlab(Slabs.Pressure);
+    DestroySlab(Slabs.Temperature);
+    DestroySlab(Slabs.LightTransmittance);
+    DestroySlab(Slabs.LightCache);
+
+    DestroySurface(Surfaces.Divergence);
+    DestroySurface(Surfaces.BlurredDensity);
+    DestroySurface(Surfaces.BlurScratch);
+    DestroySurface(Surfaces.Obstacles);
+    if (Surfaces.VelocityObstacles.ColorTexture != Surfaces.Obstacles.ColorTexture)
+    {
+        DestroySurface(Surfaces.VelocityObstacles);
+    }
+    DestroySurface(Surfaces.Residual);
+    DestroySurface(Surfaces.BrickActivity);
+    DestroySurface(Surfaces.BrickMask);
+    DestroySurface(Surfaces.DensityMax);
+    DestroySurface(Surfaces.AdvectForward);
+    DestroySurface(Surfaces.AdvectBackward);
+    DestroySurface(Surfaces.ScalarForward);
+    DestroySurface(Surfaces.ScalarBackward);
+    DestroySurface(Surfaces.Vorticity);
+    DestroySurface(Surfaces.ObstacleVelocity);
+    DestroySurface(Surfaces.Walls);
+    DestroySurface(Surfaces.Solid);
+    if (Surfaces.VelocityWalls.ColorTexture != Surfaces.Walls.ColorTexture)
+    {
+        DestroySurface(Surfaces.VelocityWalls);
+        DestroySurface(Surfaces.VelocitySolid);
+    }
+
+    DestroyMultigrid(Multigrid);
+}
+
+// Pushes new settings into the solver. Changing the grid dimensions or a
+// field's format throws away the current smoke and reallocates every volume.
+void Smokem::setSimulationSettings(const SimulationSettings& value)
+{
+    SimulationSettings next = value;
+    next.GridWidth = std::max(BrickSize, (next.GridWidth + BrickSize - 1) / BrickSize * BrickSize);
+    next.GridHeight = std::max(BrickSize, (next.GridHeight + BrickSize - 1) / BrickSize * BrickSize);
+    next.GridDepth = std::max(BrickSize, (next.GridDepth + BrickSize - 1) / BrickSize * BrickSize);
+
+    // The CPU solver keeps every field on one grid
+    next.VelocityDownsample = GetSolverBackend() == SolverBackend::Cpu ? 1 : std::min(std::max(next.VelocityDownsample, 1), 2);
+
+    bool resized = next.GridWidth != settings.GridWidth ||
+                   next.GridHeight != settings.GridHeight ||
+                   next.GridDepth != settings.GridDepth ||
+                   next.VelocityDownsample != settings.VelocityDownsample ||
+                   next.VelocityFormat != settings.VelocityFormat ||
+                   next.DensityFormat != settings.DensityFormat ||
+                   next.TemperatureFormat != settings.TemperatureFormat ||
+                   next.PressureFormat != settings.PressureFormat;
+
+    settings = next;
+    SetSimulationSettings(settings);
+
+    if (resized)
+    {
+        destroyVolumes();
+        createVolumes();
+        assert(checkError());
+    }
+}
+
+SolverOptions Smokem::getSolverOptions() const
+{
+    return { PressureSolver(PressureMethod), EarlyExit, FuseAdvection, MacCormackAdvection, SparseDomain };
+}
+
+void Smokem::setSolverOptions(const SolverOptions& value)
+{
+    PressureMethod = value.Pressure;
+    EarlyExit = value.EarlyExit;
+    FuseAdvection = value.FuseAdvection;
+    MacCormackAdvection = value.MacCormackAdvection;
+    SparseDomain = value.SparseDomain;
+}
+
+QualityKnobs Smokem::getQualityKnobs() const
+{
+    return {
+        settings.NumJacobiIterations,
+        ViewSamples,
+        LightSamples,
+        LightCacheInterval,
+        settings.GridWidth,
+        settings.GridHeight,
+        settings.GridDepth
+    };
+}
+
+void Smokem::setQualityKnobs(const QualityKnobs& knobs)
+{
+    SimulationSettings next = settings;
+    next.NumJacobiIterations = knobs.JacobiIterations;
+    next.GridWidth = knobs.GridWidth;
+    next.GridHeight = knobs.GridHeight;
+    next.GridDepth = knobs.GridDepth;
+    setSimulationSettings(next);
+
+    // Set after the settings, since a resize resets the sample counts to match the grid
+    ViewSamples = knobs.ViewSamples;
+    LightSamples = knobs.LightSamples;
+    LightCacheInterval = knobs.LightCacheInterval;
+}
+
+// The same steps as the GPU pipeline below, on the CPU solver
+static void UpdateCpuSmoke(const SimulationSettings& settings)
+{
+    Advect(CpuFields.Velocity.Ping, CpuFields.Velocity.Ping, CpuFields.Obstacles, CpuFields.Velocity.Pong, VelocityDissipation);
+    SwapSurfaces(&CpuFields.Velocity);
+
+    Advect(CpuFields.Velocity.Ping, CpuFields.Temperature.Ping, CpuFields.Obstacles, CpuFields.Temperature.Pong, TemperatureDissipation);
+    SwapSurfaces(&CpuFields.Temperature);
+
+    Advect(CpuFields.Velocity.Ping, CpuFields.Density.Ping, CpuFields.Obstacles, CpuFields.Density.Pong, DensityDissipation);
+    SwapSurfaces(&CpuFields.Density);
+
+    ApplyBuoyancy(CpuFields.Velocity.Ping, CpuFields.Temperature.Ping, CpuFields.Density.Ping, CpuFields.Velocity.Pong);
+    SwapSurfaces(&CpuFields.Velocity);
+
+    glm::vec3 impulsePosition(settings.GridWidth / 2.0f, settings.GridHeight - (int) settings.SplatRadius / 2.0f, settings.GridDepth / 2.0f);
+    ApplyImpulse(CpuFields.Temperature.Ping, impulsePosition, ImpulseTemperature);
+    ApplyImpulse(CpuFields.Density.Ping, impulsePosition, ImpulseDensity);
+
+    ComputeDivergence(CpuFields.Velocity.Ping, CpuFields.Obstacles, CpuFields.Divergence);
+    ClearSurface(CpuFields.Pressure.Ping, 0);
+
+    for (int i = 0; i < settings.NumJacobiIterations; ++i)
+    {
+        Jacobi(CpuFields.Pressure.Ping, CpuFields.Divergence, CpuFields.Obstacles, CpuFields.Pressure.Pong, CellSize, 1.0f);
+        SwapSurfaces(&CpuFields.Pressure);
+    }
+    PressureIterations = settings.NumJacobiIterations;
+
+    SubtractGradient(CpuFields.Velocity.Ping, CpuFields.Pressure.Ping, CpuFields.Obstacles, CpuFields.Velocity.Pong);
+    SwapSurfaces(&CpuFields.Velocity);
+}
+
+// Re-voxelizes any scene object that moved, then rebuilds the flags on every
+// grid, including the multigrid's coarse levels. Frames where nothing moved
+// keep the flags from before.
+// Takes in every residual check the GPU has finished with, oldest first.
+// Returns true when one from the current step is within tolerance.
+static bool CollectResidualChecks()
+{
+    bool converged = false;
+    ResidualCheck check;
+    while (PollResidualNorm(&check))
+    {
+        if (check.Step != CheckedStep)
+        {
+            CheckedStep = check.Step;
+            CheckedIterations = -1;
+        }
+        if (check.Norm <= PressureTolerance && CheckedIterations < 0)
+        {
+            CheckedIterations = check.Iterations;
+        }
+        converged = converged || (check.Step == SimulationStep && check.Norm <= PressureTolerance);
+        PressureResidual = check.Norm;
+    }
+    return converged;
+}
+
+static void UpdateSceneObstacles(const SimulationSettings& settings)
+{
+    glm::mat4 worldToVolume = glm::scale(glm::mat4(), glm::vec3(1.0f / VolumeSize)) * glm::translate(glm::mat4(), -smokeTranslation);
+    if (!Voxelizer.update(worldToVolume, settings.GridWidth, settings.GridHeight, settings.GridDepth))
+    {
+        return;
+    }
+
+    // Obstacle velocities need a full volume only while something is moving.
+    // The step after everything stops swaps the single zero texel back in.
+    bool moving = Voxelizer.moving();
+    bool allocated = Surfaces.ObstacleVelocity.Width == Surfaces.VelocitySolid.Width;
+    if (moving != allocated)
+    {
+        SurfacePod grid = Surfaces.VelocitySolid;
+        DestroySurface(Surfaces.ObstacleVelocity);
+        Surfaces.ObstacleVelocity = moving ? CreateVolume(grid.Width, grid.Height, grid.Depth, 3) : CreateVolume(1, 1, 1, 3);
+        SetObstacleVelocity(Surfaces.ObstacleVelocity);
+    }
+
+    glBindVertexArray(Vaos.FullscreenQuad);
+    SurfacePod velocity = moving ? Surfaces.ObstacleVelocity : SurfacePod();
+    Voxelizer.composite(Surfaces.VelocityWalls, Surfaces.VelocitySolid, velocity, settings.TimeStep);
+    BuildObstacleFlags(Surfaces.VelocitySolid, Surfaces.VelocityObstacles);
+
+    // The scalar fields only need to know what is solid
+    if (Surfaces.VelocityObstacles.ColorTexture != Surfaces.Obstacles.ColorTexture)
+    {
+        SurfacePod none = {};
+        Voxelizer.composite(Surfaces.Walls, Surfaces.Solid, none, settings.TimeStep);
+        BuildObstacleFlags(Surfaces.Solid, Surfaces.Obstacles);
+    }
+
+    RestrictObstacles(Surfaces.VelocitySolid, Multigrid);
+}
+
 void Smokem::updateSmoke(float dt)
 {
     Config cfg = getConfig();
@@ -137,92 +565,586 @@ void Smokem::updateSmoke(float dt)
     glDisable(GL_CULL_FACE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    if (SimulateFluid)
+    if (SimulateFluid && GetSolverBackend() == SolverBackend::Cpu)
     {
+        auto start = std::chrono::steady_clock::now();
+        UpdateCpuSmoke(settings);
+        CpuStepMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        UploadVolume(CpuFields.Density.Ping, Slabs.Density.Ping);
+        DensityChanged = true;
+    }
+    else if (SimulateFluid)
+    {
+        Timer.begin("Obstacles", "Simulation");
+        UpdateSceneObstacles(settings);
+        Timer.end();
+
         glBindVertexArray(Vaos.FullscreenQuad);
-        glViewport(0, 0, GridWidth, GridHeight);
 
-        Advect(Slabs.Velocity.Ping, Slabs.Velocity.Ping, Surfaces.Obstacles, Slabs.Velocity.Pong, VelocityDissipation);
-        SwapSurfaces(&Slabs.Velocity);
+        // Bricks with no smoke, heat or motion are skipped by every pass below
+        Timer.begin("Brick mask", "Simulation");
+        if (SparseDomain)
+        {
+            UpdateBrickMask(Slabs.Density.Ping, Slabs.Temperature.Ping, Slabs.Velocity.Ping, Surfaces.BrickActivity, Surfaces.BrickMask, SparseThreshold);
+        }
+        else
+        {
+            ClearSurface(Surfaces.BrickMask, 1);
+        }
+        Timer.end();
+
+        glViewport(0, 0, settings.GridWidth, settings.GridHeight);
+
+        Timer.begin("Advect", "Simulation");
+        if (MacCormackAdvection)
+        {
+            AdvectMacCormack(Slabs.Velocity.Ping, Slabs.Velocity.Ping, Surfaces.VelocityObstacles, Slabs.Velocity.Pong,
+                             Surfaces.AdvectForward, Surfaces.AdvectBackward, VelocityDissipation);
+            SwapSurfaces(&Slabs.Velocity);
+
+            AdvectMacCormack(Slabs.Velocity.Ping, Slabs.Temperature.Ping, Surfaces.Obstacles, Slabs.Temperature.Pong,
+                             Surfaces.ScalarForward, Surfaces.ScalarBackward, TemperatureDissipation);
+            SwapSurfaces(&Slabs.Temperature);
+
+            AdvectMacCormack(Slabs.Velocity.Ping, Slabs.Density.Ping, Surfaces.Obstacles, Slabs.Density.Pong,
+                             Surfaces.ScalarForward, Surfaces.ScalarBackward, DensityDissipation);
+            SwapSurfaces(&Slabs.Density);
+        }
+        else if (FuseAdvection && settings.VelocityDownsample == 1)
+        {
+            AdvectFused(Slabs.Velocity.Ping, Slabs.Temperature.Ping, Slabs.Density.Ping, Surfaces.Obstacles,
+                        Slabs.Velocity.Pong, Slabs.Temperature.Pong, Slabs.Density.Pong,
+                        glm::vec3(VelocityDissipation, TemperatureDissipation, DensityDissipation));
+            SwapSurfaces(&Slabs.Velocity);
+            SwapSurfaces(&Slabs.Temperature);
+            SwapSurfaces(&Slabs.Density);
+        }
+        else
+        {
+            Advect(Slabs.Velocity.Ping, Slabs.Velocity.Ping, Surfaces.VelocityObstacles, Slabs.Velocity.Pong, VelocityDissipation);
+            SwapSurfaces(&Slabs.Velocity);
 
-        Advect(Slabs.Velocity.Ping, Slabs.Temperature.Ping, Surfaces.Obstacles, Slabs.Temperature.Pong, TemperatureDissipation);
-        SwapSurfaces(&Slabs.Temperature);
+            Advect(Slabs.Velocity.Ping, Slabs.Temperature.Ping, Surfaces.Obstacles, Slabs.Temperature.Pong, TemperatureDissipation);
+            SwapSurfaces(&Slabs.Temperature);
 
-        Advect(Slabs.Velocity.Ping, Slabs.Density.Ping, Surfaces.Obstacles, Slabs.Density.Pong, DensityDissipation);
-        SwapSurfaces(&Slabs.Density);
+            Advect(Slabs.Velocity.Ping, Slabs.Density.Ping, Surfaces.Obstacles, Slabs.Density.Pong, DensityDissipation);
+            SwapSurfaces(&Slabs.Density);
+        }
+        Timer.end();
 
+        Timer.begin("Buoyancy", "Simulation");
         ApplyBuoyancy(Slabs.Velocity.Ping, Slabs.Temperature.Ping, Slabs.Density.Ping, Slabs.Velocity.Pong);
         SwapSurfaces(&Slabs.Velocity);
+        Timer.end();
+
+        if (VorticityStrength > 0)
+        {
+            Timer.begin("Vorticity", "Simulation");
+            ComputeVorticity(Slabs.Velocity.Ping, Surfaces.VelocityObstacles, Surfaces.Vorticity);
+            ApplyVorticityConfinement(Slabs.Velocity.Ping, Surfaces.Vorticity, Surfaces.VelocityObstacles, Slabs.Velocity.Pong, VorticityStrength);
+            SwapSurfaces(&Slabs.Velocity);
+            Timer.end();
+        }
+
+        Timer.begin("Impulse", "Simulation");
+        glm::vec3 impulsePosition(settings.GridWidth / 2.0f, settings.GridHeight - (int) settings.SplatRadius / 2.0f, settings.GridDepth / 2.0f);
+        ApplyImpulse(Slabs.Temperature.Ping, impulsePosition, ImpulseTemperature);
+        ApplyImpulse(Slabs.Density.Ping, impulsePosition, ImpulseDensity);
+        Timer.end();
+
+        Timer.begin("Divergence", "Simulation");
+        ComputeDivergence(Slabs.Velocity.Ping, Surfaces.VelocityObstacles, Surfaces.Divergence);
+        // With the sparse domain on, the solve starts from last step's pressure.
+        // Inactive bricks copy it through, so their active neighbours see the
+        // pressure last solved there rather than a zero boundary.
+        if (!SparseDomain)
+        {
+            ClearSurface(Slabs.Pressure.Ping, 0);
+        }
+        Timer.end();
 
-        ApplyImpulse(Slabs.Temperature.Ping, ImpulsePosition, ImpulseTemperature);
-        ApplyImpulse(Slabs.Density.Ping, ImpulsePosition, ImpulseDensity);
-        ComputeDivergence(Slabs.Velocity.Ping, Surfaces.Obstacles, Surfaces.Divergence);
-        ClearSurface(Slabs.Pressure.Ping, 0);
+        ++SimulationStep;
+        if (PressureMethod == MultigridSolver)
+        {
+            for (int i = 0; i < NumVCycles; ++i)
+            {
+                Timer.begin("Pressure", "Simulation");
+                VCycle(&Slabs.Pressure, Surfaces.Divergence, Surfaces.VelocityObstacles, Multigrid);
+                Timer.end();
+            }
+            PressureIterations = NumVCycles;
 
-        for (int i = 0; i < NumJacobiIterations; ++i)
+            // The V-cycles don't depend on the residual, so it's only measured
+            // to be compared with the iterative solvers'
+            if (ReportResidual)
+            {
+                Timer.begin("Residual", "Simulation");
+                ComputeResidual(Slabs.Pressure.Ping, Surfaces.Divergence, Surfaces.VelocityObstacles, Surfaces.Residual, CellSize);
+                RequestResidualNorm(Surfaces.Residual, { SimulationStep, NumVCycles, 0 });
+                Timer.end();
+            }
+            CollectResidualChecks();
+
+            // V-cycles say nothing about the iterations the other solvers need
+            CheckedIterations = -1;
+        }
+        else
         {
-            Jacobi(Slabs.Pressure.Ping, Surfaces.Divergence, Surfaces.Obstacles, Slabs.Pressure.Pong);
-            SwapSurfaces(&Slabs.Pressure);
+            // Residual checks are read back without waiting, so one is rarely
+            // back before the step has issued all its iterations. Besides
+            // stopping on a check of this step that has arrived, the solve
+            // stops a batch after the point where the last checked step
+            // reached the tolerance. Quiet frames converge after a handful.
+            int limit = settings.NumJacobiIterations;
+            if (EarlyExit)
+            {
+                CollectResidualChecks();
+                if (CheckedIterations >= 0)
+                {
+                    limit = std::min(limit, CheckedIterations + ResidualCheckInterval);
+                }
+            }
+
+            int i = 0;
+            while (true)
+            {
+                if (EarlyExit)
+                {
+                    Timer.begin("Residual", "Simulation");
+                    ComputeResidual(Slabs.Pressure.Ping, Surfaces.Divergence, Surfaces.VelocityObstacles, Surfaces.Residual, CellSize);
+                    RequestResidualNorm(Surfaces.Residual, { SimulationStep, i, 0 });
+                    Timer.end();
+                    if (CollectResidualChecks()) break;
+                }
+                if (i >= limit) break;
+
+                // Iterations between two residual checks are timed as one batch
+                int batchEnd = std::min(i + ResidualCheckInterval, limit);
+                Timer.begin("Pressure", "Simulation");
+                for (; i < batchEnd; ++i)
+                {
+                    if (PressureMethod == RedBlackSORSolver)
+                    {
+                        RedBlackSOR(Slabs.Pressure.Ping, Surfaces.Divergence, Surfaces.VelocityObstacles, Slabs.Pressure.Pong, SorOmega, 0);
+                        SwapSurfaces(&Slabs.Pressure);
+                        RedBlackSOR(Slabs.Pressure.Ping, Surfaces.Divergence, Surfaces.VelocityObstacles, Slabs.Pressure.Pong, SorOmega, 1);
+                        SwapSurfaces(&Slabs.Pressure);
+                    }
+                    else
+                    {
+                        Jacobi(Slabs.Pressure.Ping, Surfaces.Divergence, Surfaces.VelocityObstacles, Slabs.Pressure.Pong, CellSize, 1.0f);
+                        SwapSurfaces(&Slabs.Pressure);
+                    }
+                }
+                Timer.end();
+            }
+            PressureIterations = i;
         }
 
         assert(checkError());
 
-        SubtractGradient(Slabs.Velocity.Ping, Slabs.Pressure.Ping, Surfaces.Obstacles, Slabs.Velocity.Pong);
+        Timer.begin("Subtract gradient", "Simulation");
+        SubtractGradient(Slabs.Velocity.Ping, Slabs.Pressure.Ping, Surfaces.VelocityObstacles, Slabs.Velocity.Pong);
         SwapSurfaces(&Slabs.Velocity);
+        Timer.end();
+
+        DensityChanged = true;
     }
     assert(checkError());
 }
 
-void Smokem::renderSmoke()
+// Reallocates the offscreen raycast targets whenever the window size or the
+// raycast scale changes. Fresh targets have no usable history.
+static void ResizeRaycastTargets(GLsizei windowWidth, GLsizei windowHeight, int scale)
 {
-    Config cfg = getConfig();
+    GLsizei width = windowWidth / scale;
+    GLsizei height = windowHeight / scale;
+    if (RaycastTargets.Smoke.Ping.Width == width && RaycastTargets.Smoke.Ping.Height == height &&
+        RaycastTargets.SceneDepth.Width == windowWidth && RaycastTargets.SceneDepth.Height == windowHeight)
+    {
+        return;
+    }
 
-    glActiveTexture(GL_TEXTURE0);
+    if (RaycastTargets.Smoke.Ping.ColorTexture)
+    {
+        DestroySlab(RaycastTargets.Smoke);
+        DestroySurface(RaycastTargets.SceneDepth);
+        DestroySurface(RaycastTargets.SceneDistance);
+    }
 
-    // Blur and brighten the density map
-    bool BlurAndBrighten = true;
-    if (BlurAndBrighten)
+    RaycastTargets.Smoke.Ping = CreateSurface(width, height, 4);
+    RaycastTargets.Smoke.Pong = CreateSurface(width, height, 4);
+    RaycastTargets.SceneDepth = CreateDepthSurface(windowWidth, windowHeight);
+    RaycastTargets.SceneDistance = CreateSurface(width, height, 1);
+    HistoryValid = false;
+}
+
+// Sweeps away from the light along whichever axis points at it most
+static int LightSweepAxis(glm::vec3 light)
+{
+    glm::vec3 toLight = light - glm::vec3(0.5f);
+    int axis = 0;
+    for (int i = 1; i < 3; ++i)
     {
-        glDisable(GL_BLEND);
-        glBindFramebuffer(GL_FRAMEBUFFER, Surfaces.BlurredDensity.FboHandle);
-        glViewport(0, 0, Slabs.Density.Ping.Width, Slabs.Density.Ping.Height);
-        glBindVertexArray(Vaos.FullscreenQuad);
-        glBindTexture(GL_TEXTURE_3D, Slabs.Density.Ping.ColorTexture);
+        if (std::abs(toLight[i]) > std::abs(toLight[axis]))
+        {
+            axis = i;
+        }
+    }
+    return axis;
+}
 
-        GLuint pid = BlurProgram->id();
-        glUseProgram(pid);
-        SetUniform(pid, "DensityScale", 5.0f);
-        SetUniform(pid, "StepSize", sqrtf(2.0) / float(ViewSamples));
-        SetUniform(pid, "InverseSize", 1.0f / glm::vec3(GridWidth, GridHeight, GridDepth));
+// Gaussian weights for the taps 0 to BlurRadius on one side, normalised over
+// both sides
+static std::vector<float> BlurWeights()
+{
+    std::vector<float> weights(MaxBlurRadius + 1, 0.0f);
+    float sigma = std::max(0.5f, BlurRadius / 2.0f);
+    float sum = 0;
+    for (int i = 0; i <= BlurRadius; ++i)
+    {
+        weights[i] = std::exp(-0.5f * i * i / (sigma * sigma));
+        sum += i == 0 ? weights[i] : 2 * weights[i];
+    }
+    for (auto& w : weights)
+    {
+        w /= sum;
+    }
+    return weights;
+}
 
-        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GridDepth);
+// Blurs and brightens the density with a separable Gaussian, one pass per
+// axis, ending in BlurredDensity. The pass along `fusedAxis` is skipped and
+// left to the light sweep, which finds the other two passes in BlurScratch.
+static void BlurDensity(int fusedAxis)
+{
+    int axes[3] = { 0, 1, 2 };
+    if (fusedAxis >= 0)
+    {
+        std::swap(axes[fusedAxis], axes[2]);
     }
-    assert(checkError());
+    int passes = fusedAxis >= 0 ? 2 : 3;
+
+    glDisable(GL_BLEND);
+    glBindVertexArray(Vaos.FullscreenQuad);
 
-    // Generate the light cache
-    bool CacheLights = true;
-    if (CacheLights)
+    GLuint pid = BlurProgram->id();
+    glUseProgram(pid);
+    SetUniform(pid, "BlurRadius", BlurRadius);
+    SetUniform(pid, "BlurWeights", BlurWeights());
+    BindBrickMask(pid);
+
+    // Alternate between the two volumes so the third pass lands in BlurredDensity
+    SurfacePod source = Slabs.Density.Ping;
+    for (int i = 0; i < passes; ++i)
     {
-        glDisable(GL_BLEND);
-        glBindFramebuffer(GL_FRAMEBUFFER, Surfaces.LightCache.FboHandle);
-        glViewport(0, 0, Surfaces.LightCache.Width, Surfaces.LightCache.Height);
-        glBindVertexArray(Vaos.FullscreenQuad);
-        glBindTexture(GL_TEXTURE_3D, Surfaces.BlurredDensity.ColorTexture);
+        SurfacePod dest = i == 1 ? Surfaces.BlurScratch : Surfaces.BlurredDensity;
+        glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+        glViewport(0, 0, dest.Width, dest.Height);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, source.ColorTexture);
+
+        SetUniform(pid, "Axis", axes[i]);
+        SetUniform(pid, "DensityScale", i == 0 ? 5.0f : 1.0f);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+        source = dest;
+    }
+}
+
+// Groups the scene lights into passes. The sweep can only share a pass
+// between lights that point at the volume along the same axis and side.
+static std::vector<LightBatch> PlanLightBatches()
+{
+    SurfacePod cache = Slabs.LightCache.Ping;
+    GLsizei size[3] = { cache.Width, cache.Height, cache.Depth };
+
+    std::vector<LightBatch> batches;
+    for (auto& light : lights)
+    {
+        glm::vec3 position = (light.position - smokeTranslation) / VolumeSize;
+        int axis = SweepLightCache ? LightSweepAxis(position) : 2;
+        int direction = SweepLightCache && position[axis] < 0.5f ? -1 : 1;
+
+        LightBatch* batch = nullptr;
+        for (auto& b : batches)
+        {
+            if (b.Axis == axis && b.Direction == direction && b.Positions.size() < LightBatchSize)
+            {
+                batch = &b;
+            }
+        }
+        if (!batch)
+        {
+            batches.push_back({ axis, direction, size[axis] });
+            batch = &batches.back();
+        }
+
+        batch->Positions.push_back(position);
+        batch->Colors.push_back(light.smoke);
+    }
+    return batches;
+}
+
+// Writes `count` slices of one batch into the light cache being refreshed,
+// starting `first` slices into the batch. The sweep has to run its slices in
+// order, the march can do any. With `fuseBlur` the sweep also does the density
+// blur's pass along its axis, reading the other two passes from BlurScratch.
+static void RenderLightBatch(const LightBatch& batch, GLsizei first, GLsizei count, bool fuseBlur)
+{
+    SurfacePod cache = Slabs.LightCache.Pong;
+    GLsizei size[3] = { cache.Width, cache.Height, cache.Depth };
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, fuseBlur ? Surfaces.BlurScratch.ColorTexture : Surfaces.BlurredDensity.ColorTexture);
+
+    if (SweepLightCache)
+    {
+        GLuint pid = LightSweepProgram->id();
+        glUseProgram(pid);
+        SetUniform(pid, "Density", 0);
+        SetUniform(pid, "Previous", 1);
+        SetUniform(pid, "LightPositions", batch.Positions);
+        SetUniform(pid, "LightColors", batch.Colors);
+        SetUniform(pid, "LightCount", int(batch.Positions.size()));
+        SetUniform(pid, "Absorption", SmokeAbsorption);
+        SetUniform(pid, "Axis", batch.Axis);
+        SetUniform(pid, "Direction", batch.Direction);
+        SetUniform(pid, "FuseBlur", fuseBlur ? 1 : 0);
+        if (fuseBlur)
+        {
+            SetUniform(pid, "BlurRadius", BlurRadius);
+            SetUniform(pid, "BlurWeights", BlurWeights());
+            BindBrickMask(pid);
+        }
+
+        // Each slice writes its transmittance into one volume of the pair while
+        // reading the previous slice from the other, so nothing is read while
+        // it's being drawn to. The light itself is added straight into the cache.
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glBindFramebuffer(GL_FRAMEBUFFER, LightSweepFbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, cache.ColorTexture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, fuseBlur ? Surfaces.BlurredDensity.ColorTexture : 0, 0);
+        glDrawBuffers(fuseBlur ? 3 : 2, drawBuffers);
+        glEnablei(GL_BLEND, 1);
+
+        for (GLsizei n = first; n < first + count; ++n)
+        {
+            GLsizei slice = batch.Direction > 0 ? size[batch.Axis] - 1 - n : n;
+            SurfacePod target = n % 2 ? Slabs.LightTransmittance.Pong : Slabs.LightTransmittance.Ping;
+            SurfacePod previous = n % 2 ? Slabs.LightTransmittance.Ping : Slabs.LightTransmittance.Pong;
+
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target.ColorTexture, 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_3D, previous.ColorTexture);
+
+            // A z slice is a single layer, x and y slices are one column or row of every layer
+            if (batch.Axis == 2)
+            {
+                glViewport(0, 0, size[0], size[1]);
+                SetUniform(pid, "LayerOffset", slice);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, 1);
+            }
+            else
+            {
+                bool x = batch.Axis == 0;
+                glViewport(x ? slice : 0, x ? 0 : slice, x ? 1 : size[0], x ? size[1] : 1);
+                SetUniform(pid, "LayerOffset", 0);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, size[2]);
+            }
+        }
+
+        glBindTexture(GL_TEXTURE_3D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glDrawBuffers(1, drawBuffers);
+    }
+    else
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, cache.FboHandle);
+        glViewport(0, 0, size[0], size[1]);
+        glEnable(GL_BLEND);
 
         GLuint pid = LightProgram->id();
         glUseProgram(pid);
+        SetUniform(pid, "LightPositions", batch.Positions);
+        SetUniform(pid, "LightColors", batch.Colors);
+        SetUniform(pid, "LightCount", int(batch.Positions.size()));
+        SetUniform(pid, "Absorption", SmokeAbsorption);
         SetUniform(pid, "LightStep", sqrtf(2.0) / float(LightSamples));
         SetUniform(pid, "LightSamples", LightSamples);
-        SetUniform(pid, "InverseSize", 1.0f / glm::vec3(GridWidth, GridHeight, GridDepth));
+        SetUniform(pid, "InverseSize", 1.0f / glm::vec3(size[0], size[1], size[2]));
+        SetUniform(pid, "LayerOffset", first);
+        BindBrickMask(pid);
 
-        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GridDepth);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    }
+
+    glDisable(GL_BLEND);
+}
+
+// Writes `count` slices of the refresh, starting `first` slices in. A refresh
+// runs through every batch in turn, each one adding its lights to the cache.
+// `fuseBlur` hands the density blur's last pass to the batch, of which there
+// is only one then.
+static void RenderLightCache(const std::vector<LightBatch>& batches, GLsizei first, GLsizei count, bool fuseBlur)
+{
+    glDisable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glBindVertexArray(Vaos.FullscreenQuad);
+
+    GLsizei offset = 0;
+    for (auto& batch : batches)
+    {
+        GLsizei begin = std::max(first, offset);
+        GLsizei end = std::min(first + count, offset + batch.Slices);
+        if (begin < end)
+        {
+            RenderLightBatch(batch, begin - offset, end - begin, fuseBlur && &batch == &batches.front());
+        }
+        offset += batch.Slices;
+    }
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void Smokem::renderSmoke()
+{
+    Config cfg = getConfig();
+
+    glActiveTexture(GL_TEXTURE0);
+
+    bool densityStale = DensityChanged || BlurredRadius != BlurRadius;
+    if (densityStale)
+    {
+        LightCacheDirty = true;
+    }
+
+    // A moved light or new absorption invalidates a refresh that is halfway
+    // through, new density only means another refresh once this one is done
+    LightCacheInputs inputs = { {}, SmokeAbsorption, SweepLightCache, LightSamples };
+    for (auto& light : lights)
+    {
+        inputs.Lights.push_back((light.position - smokeTranslation) / VolumeSize);
+        inputs.Lights.push_back(light.smoke);
+    }
+    if (inputs.Lights != CachedLight.Lights || inputs.Absorption != CachedLight.Absorption ||
+        inputs.Sweep != CachedLight.Sweep || (!inputs.Sweep && inputs.Samples != CachedLight.Samples))
+    {
+        CachedLight = inputs;
+        LightCacheDirty = true;
+        LightCacheCursor = 0;
+    }
+
+    // Generate the light cache, either all at once every LightCacheInterval
+    // frames or a round-robin share of its slices every frame. It is built
+    // into Pong and only swapped in once complete.
+    std::vector<LightBatch> batches = PlanLightBatches();
+    GLsizei slices = 0;
+    for (auto& batch : batches)
+    {
+        slices += batch.Slices;
+    }
+
+    bool due = FrameCount++ % LightCacheInterval == 0;
+    bool start = LightCacheCursor == 0 && LightCacheDirty && (AmortizeLightCache || due);
+
+    // Blur and brighten the density map. When the whole light cache is swept
+    // this frame anyway, the blur's pass along the sweep axis is done by the
+    // sweep instead of by a pass of its own. The sweep attenuates with the
+    // density it hasn't finished blurring yet, so this is only done when a
+    // single batch lights the volume; with more, later batches would see the
+    // fully blurred density and the lights would no longer match.
+    bool fuseBlur = FuseBlur && SweepLightCache && densityStale && start && !AmortizeLightCache && batches.size() == 1;
+    if (densityStale)
+    {
+        Timer.begin("Blur", "Lighting");
+        BlurDensity(fuseBlur ? batches.front().Axis : -1);
+        Timer.end();
     }
     assert(checkError());
 
-    // Perform raycasting
-    glEnable(GL_BLEND);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, cfg.Width, cfg.Height);
+    if (start || LightCacheCursor > 0)
+    {
+        Timer.begin("Light cache", "Lighting");
+
+        // Density that changes from here on is picked up by the next refresh
+        if (start)
+        {
+            LightCacheDirty = false;
+            ClearSurface(Slabs.LightCache.Pong, 0);
+        }
+
+        GLsizei count = AmortizeLightCache ? (slices + LightCacheInterval - 1) / LightCacheInterval : slices;
+        count = std::min(count, slices - LightCacheCursor);
+        RenderLightCache(batches, LightCacheCursor, count, fuseBlur);
+        Timer.end();
+
+        LightCacheCursor += count;
+        if (LightCacheCursor >= slices)
+        {
+            LightCacheCursor = 0;
+            SwapSurfaces(&Slabs.LightCache);
+        }
+    }
+    assert(checkError());
+
+    if (densityStale)
+    {
+        Timer.begin("Empty space", "Raycast");
+        glBindVertexArray(Vaos.FullscreenQuad);
+        BuildDensityPyramid(Surfaces.BlurredDensity, Surfaces.DensityMax);
+        Timer.end();
+
+        DensityChanged = false;
+        BlurredRadius = BlurRadius;
+    }
+
+    // Perform raycasting, either straight onto the scene or into an offscreen
+    // target when it runs at a lower resolution or over several frames
+    glm::mat4 viewProjection = camera->getProjectionMatrix() * camera->getViewMatrix();
+    bool offscreen = RaycastScale > 1 || TemporalFrames > 1;
+    GLsizei width = cfg.Width / RaycastScale;
+    GLsizei height = cfg.Height / RaycastScale;
+
+    if (offscreen)
+    {
+        ResizeRaycastTargets(cfg.Width, cfg.Height, RaycastScale);
+
+        // The models are already drawn, so their depth says where each ray has to stop
+        Timer.begin("Scene depth", "Raycast");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, RaycastTargets.SceneDepth.FboHandle);
+        glBlitFramebuffer(0, 0, cfg.Width, cfg.Height, 0, 0, cfg.Width, cfg.Height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, RaycastTargets.SceneDepth.ColorTexture);
+
+        glDisable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, RaycastTargets.SceneDistance.FboHandle);
+        glViewport(0, 0, width, height);
+        glBindVertexArray(Vaos.CubeCenter);
+
+        GLuint distancePid = SceneDistanceProgram->id();
+        glUseProgram(distancePid);
+        SetUniform(distancePid, "SceneDepth", 0);
+        SetUniform(distancePid, "Scale", RaycastScale);
+        SetUniform(distancePid, "InverseViewProjection", glm::inverse(viewProjection));
+        SetUniform(distancePid, "RayOrigin", camera->getTranslation());
+        glDrawArrays(GL_POINTS, 0, 1);
+        Timer.end();
+
+        // Only the box's footprint is drawn, so clear whatever it left last frame
+        glBindFramebuffer(GL_FRAMEBUFFER, RaycastTargets.Smoke.Pong.FboHandle);
+        glViewport(0, 0, width, height);
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    else
+    {
+        glEnable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, cfg.Width, cfg.Height);
+        HistoryValid = false;
+    }
 
     glBindVertexArray(Vaos.CubeCenter);
 
@@ -230,21 +1152,264 @@ void Smokem::renderSmoke()
     glBindTexture(GL_TEXTURE_3D, Surfaces.BlurredDensity.ColorTexture);
 
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_3D, Surfaces.LightCache.ColorTexture);
+    glBindTexture(GL_TEXTURE_3D, Slabs.LightCache.Ping.ColorTexture);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, offscreen ? RaycastTargets.Smoke.Ping.ColorTexture : 0);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, offscreen ? RaycastTargets.SceneDistance.ColorTexture : 0);
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, Surfaces.DensityMax.ColorTexture);
 
     GLuint pid = RaycastProgram->id();
     glUseProgram(pid);
     SetUniform(pid, "Density", 0 /* DENSITY_TEXTURE_LOC */);
     SetUniform(pid, "LightCache", 1 /* LIGHT_CACHE_TEXTURE_LOC */);
+    SetUniform(pid, "History", 2);
+    SetUniform(pid, "SceneDistance", 3);
+    SetUniform(pid, "DensityMax", 4);
+    SetUniform(pid, "MaxLevel", MipLevelCount(Surfaces.DensityMax.Width, Surfaces.DensityMax.Height, Surfaces.DensityMax.Depth) - 1);
     SetUniform(pid, "InverseProjectionMatrix", glm::inverse(camera->getProjectionMatrix()));
     SetUniform(pid, "InverseViewMatrix", glm::inverse(camera->getViewMatrix()));
     SetUniform(pid, "ViewSamples", ViewSamples);
     SetUniform(pid, "RayOrigin", camera->getTranslation());
     SetUniform(pid, "FocalLength", 1.0f / std::tan(camera->getFov() / 2));
-    SetUniform(pid, "WindowSize", float(cfg.Width), float(cfg.Height));
+    SetUniform(pid, "WindowSize", float(offscreen ? width : cfg.Width), float(offscreen ? height : cfg.Height));
     SetUniform(pid, "LightSamples", sqrtf(2) / ViewSamples);
-
+    SetUniform(pid, "VolumeMin", smokeTranslation);
+    SetUniform(pid, "ViewProjection", viewProjection);
+    SetUniform(pid, "VolumeSize", VolumeSize);
+    SetUniform(pid, "Offscreen", offscreen ? 1 : 0);
+    SetUniform(pid, "TemporalFrames", TemporalFrames);
+    SetUniform(pid, "StepPhase", float(FrameCount % TemporalFrames));
+    SetUniform(pid, "HistoryWeight", HistoryValid && TemporalFrames > 1 ? 1.0f / TemporalFrames : 1.0f);
+    SetUniform(pid, "PreviousViewProjection", PreviousViewProjection);
+
+    Timer.begin("Raycast", "Raycast");
     glDrawArrays(GL_POINTS, 0, 1);
+
+    if (offscreen)
+    {
+        SwapSurfaces(&RaycastTargets.Smoke);
+        HistoryValid = true;
+
+        // Upsample against the full resolution depth and composite over the scene
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, cfg.Width, cfg.Height);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, RaycastTargets.Smoke.Ping.ColorTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, RaycastTargets.SceneDistance.ColorTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, RaycastTargets.SceneDepth.ColorTexture);
+
+        GLuint resolve = ResolveProgram->id();
+        glUseProgram(resolve);
+        SetUniform(resolve, "Source", 0);
+        SetUniform(resolve, "LowDistance", 1);
+        SetUniform(resolve, "SceneDepth", 2);
+        SetUniform(resolve, "Scale", RaycastScale);
+        SetUniform(resolve, "InverseViewProjection", glm::inverse(viewProjection));
+        SetUniform(resolve, "RayOrigin", camera->getTranslation());
+        SetUniform(resolve, "ViewProjection", viewProjection);
+        SetUniform(resolve, "VolumeMin", smokeTranslation);
+        SetUniform(resolve, "VolumeSize", VolumeSize);
+        glDrawArrays(GL_POINTS, 0, 1);
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    Timer.end();
+
+    for (GLenum unit : { GL_TEXTURE3, GL_TEXTURE2, GL_TEXTURE1, GL_TEXTURE0 })
+    {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    PreviousViewProjection = viewProjection;
+}
+
+struct FieldMemory {
+    const char* Name;
+    const char* Format;     // empty for groups of volumes in mixed formats
+    size_t Bytes;
+};
+
+// Video memory held by each field and by the volumes grouped under it.
+// Volumes shared between fields, like the obstacles when velocity runs on
+// the full grid, are only counted once.
+static std::vector<FieldMemory> MemoryReport()
+{
+    bool split = Surfaces.VelocityObstacles.ColorTexture != Surfaces.Obstacles.ColorTexture;
+
+    size_t multigrid = SurfaceBytes(Surfaces.Residual);
+    for (size_t level = 0; level < Multigrid.size(); ++level)
+    {
+        const MultigridLevel& l = Multigrid[level];
+        if (level > 0)
+        {
+            multigrid += SlabBytes(l.Pressure) + SurfaceBytes(l.Divergence) + SurfaceBytes(l.Obstacles) + SurfaceBytes(l.Solid);
+        }
+        if (level < Multigrid.size() - 1)
+        {
+            multigrid += SurfaceBytes(l.Residual);
+        }
+    }
+
+    size_t obstacles = SurfaceBytes(Surfaces.Obstacles) + SurfaceBytes(Surfaces.Walls) + SurfaceBytes(Surfaces.Solid) +
+                       SurfaceBytes(Surfaces.ObstacleVelocity);
+    if (split)
+    {
+        obstacles += SurfaceBytes(Surfaces.VelocityObstacles) + SurfaceBytes(Surfaces.VelocityWalls) + SurfaceBytes(Surfaces.VelocitySolid);
+    }
+
+    size_t raycast = 0;
+    if (RaycastTargets.Smoke.Ping.ColorTexture)
+    {
+        raycast = SlabBytes(RaycastTargets.Smoke) + SurfaceBytes(RaycastTargets.SceneDepth) + SurfaceBytes(RaycastTargets.SceneDistance);
+    }
+
+    return {
+        { "Velocity", FormatName(Slabs.Velocity.Ping.Format), SlabBytes(Slabs.Velocity) },
+        { "Density", FormatName(Slabs.Density.Ping.Format), SlabBytes(Slabs.Density) },
+        { "Temperature", FormatName(Slabs.Temperature.Ping.Format), SlabBytes(Slabs.Temperature) },
+        { "Pressure", FormatName(Slabs.Pressure.Ping.Format), SlabBytes(Slabs.Pressure) },
+        { "Divergence", FormatName(Surfaces.Divergence.Format), SurfaceBytes(Surfaces.Divergence) },
+        { "Multigrid", "", multigrid },
+        { "Advection scratch", "", SurfaceBytes(Surfaces.AdvectForward) + SurfaceBytes(Surfaces.AdvectBackward) +
+                                   SurfaceBytes(Surfaces.ScalarForward) + SurfaceBytes(Surfaces.ScalarBackward) +
+                                   SurfaceBytes(Surfaces.Vorticity) },
+        { "Obstacles", "", obstacles },
+        { "Bricks", "", SurfaceBytes(Surfaces.BrickActivity) + SurfaceBytes(Surfaces.BrickMask) + SurfaceBytes(Surfaces.DensityMax) },
+        { "Lighting", "", SurfaceBytes(Surfaces.BlurredDensity) + SurfaceBytes(Surfaces.BlurScratch) +
+                          SlabBytes(Slabs.LightCache) + SlabBytes(Slabs.LightTransmittance) },
+        { "Raycast targets", "", raycast },
+    };
+}
+
+// Runs a fixed number of simulation steps back to back, without the GUI or
+// the models, then prints the GPU time per stage and the overall throughput.
+void Smokem::benchmark(int steps, bool render, const char* csvPath)
+{
+    printf("Benchmarking %d steps of a %dx%dx%d grid on the %s backend%s\n",
+           steps, settings.GridWidth, settings.GridHeight, settings.GridDepth,
+           SolverBackendName(GetSolverBackend()),
+           render ? ", with rendering" : "");
+
+    ReportResidual = true;
+    glFinish();
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < steps; ++i)
+    {
+        Timer.nextFrame();
+        updateSmoke(settings.TimeStep);
+
+        if (render)
+        {
+            renderSmoke();
+        }
+
+        Timer.collect();
+    }
+
+    glFinish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Everything has finished, so one more pass retires the last frame and
+    // brings back the last residual check
+    Timer.nextFrame();
+    Timer.collect();
+    CollectResidualChecks();
+    ReportResidual = false;
+
+    printf("%-18s %-11s %7s %9s %9s %9s\n", "stage", "group", "samples", "min ms", "avg ms", "p99 ms");
+    for (auto& stage : Timer.stages())
+    {
+        GpuTimer::Stats st = Timer.stats(stage);
+        printf("%-18s %-11s %7d %9.3f %9.3f %9.3f\n", stage.c_str(), Timer.group(stage).c_str(), st.Samples, st.Min, st.Avg, st.P99);
+    }
+
+    double voxels = double(settings.GridWidth) * settings.GridHeight * settings.GridDepth * steps;
+    printf("%d steps in %.3f s, %.3f ms/step, %.2f Mvoxels/s\n", steps, seconds, 1000.0 * seconds / steps, voxels / seconds / 1e6);
+    if (GetSolverBackend() != SolverBackend::Cpu && (PressureMethod == MultigridSolver || EarlyExit))
+    {
+        printf("%d %s, pressure residual %.5f\n", PressureIterations,
+               PressureMethod == MultigridSolver ? "V-cycles" : "iterations", PressureResidual);
+    }
+
+    size_t total = 0;
+    for (auto& field : MemoryReport())
+    {
+        printf("%-18s %-8s %9.2f MB\n", field.Name, field.Format, field.Bytes / 1048576.0);
+        total += field.Bytes;
+    }
+    printf("%-18s %-8s %9.2f MB\n", "total", "", total / 1048576.0);
+
+    if (csvPath)
+    {
+        Timer.exportCsv(csvPath);
+    }
+}
+
+// Runs the solver for a fixed number of steps from the start-up state, then
+// either stores the density, velocity and pressure volumes as references or
+// compares them against previously stored ones. Returns a process exit code.
+int Smokem::regression(int steps, const std::string& directory, bool record, double tolerance)
+{
+    for (int i = 0; i < steps; ++i)
+    {
+        updateSmoke(settings.TimeStep);
+    }
+    // The CPU backend only uploads density while running, so bring the rest over for the readback
+    if (GetSolverBackend() == SolverBackend::Cpu)
+    {
+        UploadVolume(CpuFields.Velocity.Ping, Slabs.Velocity.Ping);
+        UploadVolume(CpuFields.Pressure.Ping, Slabs.Pressure.Ping);
+    }
+    glFinish();
+
+    struct { const char* Name; SurfacePod Surface; int Components; } fields[] = {
+        { "density", Slabs.Density.Ping, 1 },
+        { "velocity", Slabs.Velocity.Ping, 3 },
+        { "pressure", Slabs.Pressure.Ping, 1 },
+    };
+
+    int failures = 0;
+    for (auto& f : fields)
+    {
+        std::string path = directory + "/" + f.Name + ".field";
+        FieldData actual = ReadField(f.Surface, f.Components);
+
+        if (record)
+        {
+            failures += SaveField(path, actual) ? 0 : 1;
+            continue;
+        }
+
+        FieldData expected;
+        if (!LoadField(path, expected))
+        {
+            ++failures;
+            continue;
+        }
+
+        FieldError error = CompareFields(actual, expected, tolerance);
+        printf("%-9s L2 %.6g  max %.6g  %s\n", f.Name, error.L2, error.Max, error.Passed ? "ok" : "FAILED");
+        failures += error.Passed ? 0 : 1;
+    }
+
+    if (record)
+    {
+        printf("Recorded %d steps of a %dx%dx%d grid to %s\n", steps, settings.GridWidth, settings.GridHeight, settings.GridDepth, directory.c_str());
+    }
+
+    return failures == 0 ? 0 : 1;
 }
 
 void Smokem::update(float dt)
@@ -253,6 +1418,26 @@ void Smokem::update(float dt)
 
     camera->update(dt);
 
+    // Results lag a few frames behind, which is plenty for steering quality
+    Timer.collect();
+    Timer.nextFrame();
+
+    // Stages skipped in a frame read zero, so the blur and light cache only
+    // count in the frames that actually ran them
+    StageCosts costs = {
+        Timer.total("Simulation"),
+        Timer.latest("Blur") + Timer.latest("Light cache"),
+        Timer.latest("Raycast")
+    };
+
+    QualityKnobs knobs = getQualityKnobs();
+    Governor.IterativeSolver = PressureMethod != MultigridSolver;
+    Governor.SweptLighting = SweepLightCache;
+    if (Governor.update(costs, knobs))
+    {
+        setQualityKnobs(knobs);
+    }
+
     glm::mat4 viewMatrix = camera->getViewMatrix();
     glm::mat4 projectionMatrix = camera->getProjectionMatrix();
 
@@ -286,6 +1471,7 @@ void Smokem::update(float dt)
             SetUniform(p->id(), "lightDiffuses", diffuses);
             SetUniform(p->id(), "lightSpeculars", speculars);
             SetUniform(p->id(), "lightBrightnesses", brightnesses);
+            SetUniform(p->id(), "lightCount", int(lights.size()));
         }
     }
 
@@ -303,6 +1489,11 @@ void Smokem::updateGui()
     {
         ImGui::Begin("Smokem");
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+        ImGui::Text("Solver backend: %s", SolverBackendName(GetSolverBackend()));
+        if (GetSolverBackend() == SolverBackend::Cpu)
+        {
+            ImGui::Text("CPU step %.2f ms", CpuStepMs);
+        }
 
         if (ImGui::CollapsingHeader("Camera"))
         {
@@ -344,6 +1535,175 @@ void Smokem::updateGui()
 
             ImGui::PopItemWidth();
             ImGui::EndGroup();
+
+            // The light cache is only rebuilt once this or a light changes, or the density does
+            ImGui::SliderFloat("Absorption", &SmokeAbsorption, 0.0f, 40.0f);
+            ImGui::SliderInt("Blur radius", &BlurRadius, 0, MaxBlurRadius);
+            ImGui::Checkbox("Blur in light sweep", &FuseBlur);
+        }
+
+        ReportResidual = ImGui::CollapsingHeader("Simulation");
+        if (ReportResidual)
+        {
+            ImGui::Checkbox("Simulate", &SimulateFluid);
+            ImGui::Checkbox("MacCormack advection", &MacCormackAdvection);
+            if (!MacCormackAdvection)
+            {
+                // Fusing writes every field from one pass, so it needs them on one grid
+                ImGui::Checkbox("Fused advection", &FuseAdvection);
+            }
+            ImGui::Checkbox("Sparse domain", &SparseDomain);
+            if (SparseDomain)
+            {
+                ImGui::DragFloat("Activity threshold", &SparseThreshold, 0.0001f, 0.0f, 1.0f, "%.4f");
+            }
+            ImGui::SliderFloat("Vorticity confinement", &VorticityStrength, 0.0f, 2.0f);
+
+            const char* solvers[] = { "Jacobi", "Red-black SOR", "Multigrid" };
+            ImGui::Combo("Pressure solver", &PressureMethod, solvers, 3);
+
+            SimulationSettings edited = settings;
+            bool changed = ImGui::SliderInt("Jacobi iterations", &edited.NumJacobiIterations, 1, 200);
+            changed |= ImGui::SliderFloat("Time step", &edited.TimeStep, 0.05f, 1.0f);
+            changed |= ImGui::SliderFloat("Splat radius", &edited.SplatRadius, 1.0f, 64.0f);
+
+            // Reallocates the velocity-side volumes, like a resize
+            if (GetSolverBackend() != SolverBackend::Cpu)
+            {
+                bool halfVelocity = settings.VelocityDownsample > 1;
+                if (ImGui::Checkbox("Half-resolution velocity", &halfVelocity))
+                {
+                    edited.VelocityDownsample = halfVelocity ? 2 : 1;
+                    changed = true;
+                }
+            }
+
+            // Formats reallocate their field's volumes and start the smoke over.
+            // R8 density is normalised, so it clamps anything above 1.
+            struct FormatChoice { const char* Label; GLenum* Format; std::vector<GLenum> Options; };
+            FormatChoice choices[] = {
+                { "Velocity format", &edited.VelocityFormat, { GL_RGB16F, GL_RGBA16F, GL_RGBA32F } },
+                { "Density format", &edited.DensityFormat, { GL_R8, GL_R16F, GL_R32F } },
+                { "Temperature format", &edited.TemperatureFormat, { GL_R16F, GL_R32F } },
+                { "Pressure format", &edited.PressureFormat, { GL_R16F, GL_R32F } },
+            };
+            for (auto& choice : choices)
+            {
+                if (ImGui::BeginCombo(choice.Label, FormatName(*choice.Format)))
+                {
+                    for (GLenum option : choice.Options)
+                    {
+                        if (ImGui::Selectable(FormatName(option), option == *choice.Format))
+                        {
+                            *choice.Format = option;
+                            changed = true;
+                        }
+                    }
+                    ImGui::EndCombo();
+                }
+            }
+
+            // Resizing reallocates every volume, so only do it when asked to
+            static int gridSize[3] = { settings.GridWidth, settings.GridHeight, settings.GridDepth };
+            ImGui::InputInt3("Grid size", gridSize);
+            ImGui::SameLine();
+            if (ImGui::Button("Resize"))
+            {
+                edited.GridWidth = std::min(std::max(gridSize[0], 8), 512);
+                edited.GridHeight = std::min(std::max(gridSize[1], 8), 512);
+                edited.GridDepth = std::min(std::max(gridSize[2], 8), 512);
+                changed = true;
+            }
+
+            if (changed)
+            {
+                setSimulationSettings(edited);
+                gridSize[0] = settings.GridWidth;
+                gridSize[1] = settings.GridHeight;
+                gridSize[2] = settings.GridDepth;
+            }
+
+            if (PressureMethod == RedBlackSORSolver)
+            {
+                ImGui::SliderFloat("Relaxation", &SorOmega, 1.0f, 1.95f);
+            }
+
+            if (PressureMethod != MultigridSolver)
+            {
+                ImGui::Checkbox("Stop at tolerance", &EarlyExit);
+                ImGui::DragFloat("Tolerance", &PressureTolerance, 0.0001f, 0.0f, 1.0f, "%.4f");
+                ImGui::Text("%d iterations, residual %.5f", PressureIterations, PressureResidual);
+            }
+            else
+            {
+                ImGui::Text("%d V-cycles, residual %.5f", PressureIterations, PressureResidual);
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Quality"))
+        {
+            if (ImGui::Checkbox("Adaptive quality", &Governor.Enabled) && Governor.Enabled)
+            {
+                // Whatever quality is set when the governor takes over is the most it will restore
+                Governor.setCeiling(getQualityKnobs());
+            }
+            ImGui::SliderFloat("Target ms", &Governor.TargetMs, 4.0f, 50.0f, "%.1f");
+
+            // The sweep costs the same whatever the light samples, the march is kept to compare against
+            ImGui::Checkbox("Sweep light cache", &SweepLightCache);
+            ImGui::SliderInt("Light cache interval", &LightCacheInterval, 1, 8);
+            ImGui::Checkbox("Amortize light cache", &AmortizeLightCache);
+
+            // Each frame marches 1/N of the view samples and blends into the reprojected history
+            ImGui::SliderInt("Raycast frames", &TemporalFrames, 1, 8);
+
+            // Quarter resolution marches 1/16 of the rays, upsampled against the model depth
+            const char* scales[] = { "Full", "Half", "Quarter" };
+            int scaleIndex = RaycastScale == 4 ? 2 : RaycastScale - 1;
+            if (ImGui::Combo("Raycast resolution", &scaleIndex, scales, 3))
+            {
+                RaycastScale = 1 << scaleIndex;
+            }
+
+            ImGui::Text("GPU %.2f ms, smoothed %.2f ms", Timer.total(), Governor.smoothedMs());
+            ImGui::Text("Jacobi %d, view samples %d, light samples %d", settings.NumJacobiIterations, ViewSamples, LightSamples);
+            ImGui::Text("Light cache every %d frame(s), grid %dx%dx%d", LightCacheInterval, settings.GridWidth, settings.GridHeight, settings.GridDepth);
+            ImGui::Text("Last change: %s", Governor.lastDecision().c_str());
+        }
+
+        if (ImGui::CollapsingHeader("Memory"))
+        {
+            size_t total = 0;
+            for (auto& field : MemoryReport())
+            {
+                ImGui::Text("%-18s %-8s %8.2f MB", field.Name, field.Format, field.Bytes / 1048576.0);
+                total += field.Bytes;
+            }
+            ImGui::Text("%-18s %-8s %8.2f MB", "Total", "", total / 1048576.0);
+        }
+
+        if (ImGui::CollapsingHeader("GPU timings"))
+        {
+            ImGui::Text("%-18s %7s %7s %7s %7s", "Stage", "last", "min", "avg", "p99");
+            for (const char* group : { "Simulation", "Lighting", "Raycast", "Models" })
+            {
+                ImGui::Text("%-18s %7.3f", group, Timer.total(group));
+                for (auto& stage : Timer.stages())
+                {
+                    if (Timer.group(stage) != group) continue;
+
+                    GpuTimer::Stats s = Timer.stats(stage);
+                    ImGui::Text("  %-16s %7.3f %7.3f %7.3f %7.3f", stage.c_str(), s.Latest, s.Min, s.Avg, s.P99);
+                }
+            }
+
+            static char csvPath[256] = "timings.csv";
+            ImGui::InputText("##csv", csvPath, sizeof(csvPath));
+            ImGui::SameLine();
+            if (ImGui::Button("Export CSV"))
+            {
+                Timer.exportCsv(csvPath);
+            }
         }
 
         if (ImGui::CollapsingHeader("Objects"))
@@ -367,12 +1727,54 @@ void Smokem::updateGui()
                     {
                         objects.at(i)->setTranslation(pos);
                     }
+
+                    // The CPU solver only knows about the walls
+                    bool obstacle = Voxelizer.enabled(i);
+                    if (GetSolverBackend() != SolverBackend::Cpu && ImGui::Checkbox("Obstacle", &obstacle))
+                    {
+                        Voxelizer.setEnabled(i, obstacle);
+                    }
                     ImGui::TreePop();
                 }
                 ImGui::EndGroup();
             }
         }
 
+        if (ImGui::CollapsingHeader("Lights"))
+        {
+            for (auto i = 0; i < lights.size(); i++)
+            {
+                std::string lightName = "Light" + std::to_string(i);
+
+                ImGui::BeginGroup();
+                if (ImGui::TreeNode(lightName.c_str()))
+                {
+                    Light& light = lights.at(i);
+
+                    ImGui::PushItemWidth(100);
+                    ImGui::DragFloat("X", &light.position.x, 0.2f, NULL, NULL); ImGui::SameLine();
+                    ImGui::DragFloat("Y", &light.position.y, 0.2f, NULL, NULL); ImGui::SameLine();
+                    ImGui::DragFloat("Z", &light.position.z, 0.2f, NULL, NULL);
+                    ImGui::PopItemWidth();
+
+                    // Colour and strength in the smoke, 0 leaves it out of the light cache's sums
+                    ImGui::DragFloat3("Smoke", &light.smoke.x, 0.1f, 0.0f, 50.0f);
+
+                    if (lights.size() > 1 && ImGui::Button("Remove"))
+                    {
+                        lights.erase(lights.begin() + i);
+                    }
+                    ImGui::TreePop();
+                }
+                ImGui::EndGroup();
+            }
+
+            if (lights.size() < MaxLights && ImGui::Button("Add light"))
+            {
+                lights.push_back(lights.back());
+            }
+        }
+
         ImGui::End();
     }
 
@@ -398,6 +1800,7 @@ void Smokem::render()
     Program* p = ModelProgram;
     glUseProgram(p->id());
 
+    Timer.begin("Models", "Models");
     for (const auto &obj : objects)
     {
         glm::mat3 normMtx = glm::transpose(glm::inverse(glm::mat3(obj->getModelMatrix() * camera->getViewMatrix())));
@@ -405,6 +1808,7 @@ void Smokem::render()
     
         obj->render(p->id());
     }
+    Timer.end();
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -418,4 +1822,7 @@ void Smokem::exit()
     delete RaycastProgram;
     delete LightProgram;
     delete BlurProgram;
+    delete ResolveProgram;
+    delete SceneDistanceProgram;
+    Voxelizer.destroy();
 }
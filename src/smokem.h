@@ -21,6 +21,11 @@
 #include "object.h"
 #include "shader.h"
 #include "utility.h"
+#include "timer.h"
+#include "governor.h"
+#include "regression.h"
+#include "cpusolver.h"
+#include "voxelizer.h"
 
 constexpr auto Pi = (3.14159265f);
 
@@ -33,8 +38,26 @@ typedef struct Config
     const char* Title;
     int Width;
     int Height;
+    SolverBackend Backend;
 } Config;
 
+enum PressureSolver
+{
+    JacobiSolver,
+    RedBlackSORSolver,
+    MultigridSolver
+};
+
+// Which variant of the pipeline the solver runs. Regression runs pin these
+// from the command line so a recording is always compared like for like.
+struct SolverOptions {
+    PressureSolver Pressure;
+    bool EarlyExit;             // stop Jacobi and SOR once the residual is under tolerance
+    bool FuseAdvection;         // one pass for all three fields when they share a grid
+    bool MacCormackAdvection;   // takes precedence over FuseAdvection
+    bool SparseDomain;
+};
+
 typedef struct Light
 {
     glm::vec3 position;
@@ -42,6 +65,7 @@ typedef struct Light
     glm::vec3 diffuse;
     glm::vec3 specular;
     float brightness;
+    glm::vec3 smoke; // colour and strength it lights the smoke with
 } Light;
 
 class Smokem
@@ -56,18 +80,36 @@ public:
     void updateSmoke(float dt);
     void renderSmoke();
 
+    void benchmark(int steps, bool render, const char* csvPath);
+    int regression(int steps, const std::string& directory, bool record, double tolerance);
+
     Config getConfig() const { return config; };
+    void setConfig(const Config& value) { config = value; };
+
+    SimulationSettings getSimulationSettings() const { return settings; };
+    void setSimulationSettings(const SimulationSettings& value);
+
+    SolverOptions getSolverOptions() const;
+    void setSolverOptions(const SolverOptions& value);
 
 private:
     Config config = {
         "Smokem",
-        1920, 1080
+        1920, 1080,
+        SolverBackend::Fragment
     };
 
+    SimulationSettings settings = DefaultSimulationSettings;
+
     GLFWwindow* window;
     Camera* camera;
 
     void initSmoke();
+    void createVolumes();
+    void destroyVolumes();
+
+    QualityKnobs getQualityKnobs() const;
+    void setQualityKnobs(const QualityKnobs& knobs);
 };
 
 const float ImpulseTemperature = 10.0f;
@@ -0,0 +1,253 @@
+#include "timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+void GpuTimer::nextFrame()
+{
+    Frame f = {};
+    f.Index = ++frame;
+    f.Sums.resize(timings.size(), 0.0f);
+    f.Ran.resize(timings.size(), false);
+    frames.push_back(f);
+
+    retire();
+}
+
+void GpuTimer::begin(const std::string& stage, const std::string& group)
+{
+    // Only one elapsed-time query can be open at a time
+    if (active >= 0)
+    {
+        return;
+    }
+
+    if (ring.empty())
+    {
+        GLuint handles[RingSize];
+        glGenQueries(RingSize, handles);
+
+        ring.resize(RingSize);
+        for (int i = 0; i < RingSize; ++i)
+        {
+            ring[i].Handle = handles[i];
+        }
+    }
+
+    // Drop the sample rather than reuse a query the GPU hasn't finished with
+    if (pending == RingSize)
+    {
+        return;
+    }
+
+    int s = find(stage);
+    if (s < 0)
+    {
+        Stage t = {};
+        t.Group = group;
+        timings.push_back(t);
+        order.push_back(stage);
+        s = int(timings.size()) - 1;
+    }
+
+    if (frames.empty())
+    {
+        nextFrame();
+    }
+
+    Query& q = ring[head];
+    q.Stage = s;
+    q.Frame = frame;
+
+    glBeginQuery(GL_TIME_ELAPSED, q.Handle);
+    active = s;
+}
+
+void GpuTimer::end()
+{
+    if (active < 0)
+    {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    head = (head + 1) % RingSize;
+    ++pending;
+    ++frames.back().Outstanding;
+    active = -1;
+}
+
+void GpuTimer::collect()
+{
+    // The GPU finishes queries in the order they were issued, so stop at the
+    // first one that isn't ready yet
+    while (pending > 0)
+    {
+        Query& q = ring[(head - pending + RingSize) % RingSize];
+
+        GLint available = 0;
+        glGetQueryObjectiv(q.Handle, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            break;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(q.Handle, GL_QUERY_RESULT, &elapsed);
+        --pending;
+
+        for (auto& f : frames)
+        {
+            if (f.Index != q.Frame)
+            {
+                continue;
+            }
+
+            if (int(f.Sums.size()) <= q.Stage)
+            {
+                f.Sums.resize(q.Stage + 1, 0.0f);
+                f.Ran.resize(q.Stage + 1, false);
+            }
+
+            f.Sums[q.Stage] += elapsed / 1e6f;
+            f.Ran[q.Stage] = true;
+            --f.Outstanding;
+            break;
+        }
+    }
+
+    retire();
+}
+
+// Folds every frame whose queries have all come back into the stage histories.
+// The frame being recorded is never retired, since more queries may follow.
+void GpuTimer::retire()
+{
+    while (frames.size() > 1 && frames.front().Outstanding == 0)
+    {
+        const Frame& f = frames.front();
+        for (size_t s = 0; s < timings.size(); ++s)
+        {
+            Stage& t = timings[s];
+
+            // A stage skipped in this frame cost nothing in it, but a zero
+            // would drag its history's min and average down
+            if (s >= f.Ran.size() || !f.Ran[s])
+            {
+                t.Latest = 0;
+                continue;
+            }
+
+            t.Latest = f.Sums[s];
+
+            if (int(t.History.size()) < HistorySize)
+            {
+                t.History.push_back(t.Latest);
+            }
+            else
+            {
+                t.History[t.HistoryNext] = t.Latest;
+            }
+            t.HistoryNext = (t.HistoryNext + 1) % HistorySize;
+        }
+
+        frames.pop_front();
+    }
+}
+
+int GpuTimer::find(const std::string& stage) const
+{
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (order[i] == stage)
+        {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+float GpuTimer::latest(const std::string& stage) const
+{
+    int s = find(stage);
+    return s < 0 ? 0.0f : timings[s].Latest;
+}
+
+float GpuTimer::total(const std::string& group) const
+{
+    float sum = 0;
+    for (auto& t : timings)
+    {
+        if (t.Group == group)
+        {
+            sum += t.Latest;
+        }
+    }
+    return sum;
+}
+
+float GpuTimer::total() const
+{
+    float sum = 0;
+    for (auto& t : timings)
+    {
+        sum += t.Latest;
+    }
+    return sum;
+}
+
+GpuTimer::Stats GpuTimer::stats(const std::string& stage) const
+{
+    Stats result = {};
+    int s = find(stage);
+    if (s < 0 || timings[s].History.empty())
+    {
+        return result;
+    }
+
+    std::vector<float> sorted = timings[s].History;
+    std::sort(sorted.begin(), sorted.end());
+
+    float sum = 0;
+    for (float v : sorted)
+    {
+        sum += v;
+    }
+
+    int n = int(sorted.size());
+    result.Latest = timings[s].Latest;
+    result.Min = sorted.front();
+    result.Avg = sum / n;
+    result.P99 = sorted[std::min(n - 1, int(std::ceil(0.99f * n)) - 1)];
+    result.Samples = n;
+    return result;
+}
+
+const std::string& GpuTimer::group(const std::string& stage) const
+{
+    static const std::string none;
+    int s = find(stage);
+    return s < 0 ? none : timings[s].Group;
+}
+
+bool GpuTimer::exportCsv(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        printf("Could not write timings to %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "stage,group,samples,latest_ms,min_ms,avg_ms,p99_ms\n");
+    for (auto& stage : order)
+    {
+        Stats s = stats(stage);
+        fprintf(file, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f\n", stage.c_str(), group(stage).c_str(),
+                s.Samples, s.Latest, s.Min, s.Avg, s.P99);
+    }
+
+    fclose(file);
+    return true;
+}
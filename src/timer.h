@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// Measures GPU time per named stage with GL_TIME_ELAPSED queries. Queries come
+// from a ring and are read back oldest first once the GPU has finished them, so
+// timing never waits on the pipeline. A stage may run several times in a frame
+// (the pressure solve is timed per batch); its samples are summed per frame.
+class GpuTimer
+{
+public:
+    struct Stats {
+        float Latest;
+        float Min;
+        float Avg;
+        float P99;
+        int Samples;
+    };
+
+    // Marks the start of a new frame. Call once per frame.
+    void nextFrame();
+
+    void begin(const std::string& stage, const std::string& group);
+    void end();
+
+    // Picks up every finished query without blocking.
+    void collect();
+
+    // Times from the last frame whose queries have all come back. Stages that
+    // weren't issued in that frame read 0.
+    float latest(const std::string& stage) const;
+    float total(const std::string& group) const;
+    float total() const;
+    Stats stats(const std::string& stage) const;
+
+    const std::vector<std::string>& stages() const { return order; };
+    const std::string& group(const std::string& stage) const;
+
+    // Writes min/avg/p99 of every stage over the rolling window
+    bool exportCsv(const char* path) const;
+
+private:
+    static const int RingSize = 256;
+    static const int HistorySize = 300;
+
+    struct Query {
+        GLuint Handle;
+        int Stage;
+        unsigned Frame;
+    };
+
+    struct Frame {
+        unsigned Index;
+        int Outstanding;
+        std::vector<float> Sums;
+        std::vector<bool> Ran;
+    };
+
+    struct Stage {
+        std::string Group;
+        float Latest;
+        std::vector<float> History;
+        int HistoryNext;
+    };
+
+    int find(const std::string& stage) const;
+    void retire();
+
+    std::vector<Query> ring;
+    int head = 0;       // next query to issue
+    int pending = 0;    // queries issued but not yet read back
+
+    std::deque<Frame> frames;
+    unsigned frame = 0;
+
+    std::vector<Stage> timings;
+    std::vector<std::string> order;
+    int active = -1;
+};
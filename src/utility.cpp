@@ -2,29 +2,67 @@
 
 static struct {
     GLuint Advect;
+    GLuint AdvectFused;
+    GLuint AdvectMacCormack;
     GLuint Jacobi;
+    GLuint RedBlackSOR;
     GLuint SubtractGradient;
     GLuint ComputeDivergence;
     GLuint ApplyImpulse;
     GLuint ApplyBuoyancy;
+    GLuint ComputeVorticity;
+    GLuint ApplyConfinement;
+    GLuint Residual;
+    GLuint Restrict;
+    GLuint Prolongate;
+    GLuint BrickActivity;
+    GLuint BrickDilate;
+    GLuint ObstacleFlags;
+    GLuint DensityMax;
+    GLuint MaxReduce;
 } Programs;
 
 const float CellSize = 1.25f;
-const int GridWidth = 128;
-const int GridHeight = 128;
-const int GridDepth = 128;
-const float SplatRadius = GridWidth / 8.0f;
 const float AmbientTemperature = 0.0f;
-const int NumJacobiIterations = 40;
-const float TimeStep = 0.25f;
+const int NumMultigridLevels = 4;
+const int NumVCycles = 2;
+const int NumSmoothingIterations = 2;
+const int NumCoarseIterations = 16;
+const float SmootherWeight = 6.0f / 7.0f;
+const int ResidualCheckInterval = 8;
+const int BrickSize = 8;
+const float BrickThreshold = 0.001f;
 const float SmokeBuoyancy = 1.0f;
 const float SmokeWeight = 0.0f;
 const float GradientScale = 1.125f / CellSize;
 
-const glm::vec3 ImpulsePosition(GridWidth / 2.0f, GridHeight - (int) SplatRadius / 2.0f, GridDepth / 2.0f);
+const SimulationSettings DefaultSimulationSettings = {
+    128, 128, 128,  // grid dimensions
+    40,             // Jacobi iterations
+    0.25f,          // time step
+    128 / 8.0f,     // splat radius
+    1,              // velocity downsample
+    GL_RGB16F,      // velocity format
+    GL_R16F,        // density format
+    GL_R16F,        // temperature format
+    GL_R16F         // pressure format
+};
+
+static SimulationSettings Settings = DefaultSimulationSettings;
 
 static std::map<std::pair<GLuint, std::string>, GLuint> uniformCache;
 
+static SolverBackend Backend = SolverBackend::Fragment;
+
+// Multiple render target passes attach whichever ping-pong textures they need
+static GLuint FusedFbo = 0;
+
+// Coarse volume with one texel per brick, non-zero where the solver should run
+static GLuint BrickMaskTexture = 0;
+
+// Velocity of whatever obstacle fills each solid voxel, zero for the walls
+static GLuint ObstacleVelocityTexture = 0;
+
 GLuint makeProgram(std::initializer_list<Shader> shaders)
 {
     GLuint program = glCreateProgram();
@@ -64,42 +102,141 @@ GLuint makeProgram(std::initializer_list<Shader> shaders)
     return program;
 }
 
-void InitializeSlabPrograms()
+void InitializeSlabPrograms(SolverBackend backend)
 {
-    Programs.Advect = makeProgram({
+    Backend = backend;
+
+    if (Backend == SolverBackend::Compute)
+    {
+        Programs.Advect = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/advect.comp") });
+        Programs.AdvectFused = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/advect-fused.comp") });
+        Programs.AdvectMacCormack = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/advect-maccormack.comp") });
+        Programs.Jacobi = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/jacobi.comp") });
+        Programs.RedBlackSOR = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/sor.comp") });
+        Programs.SubtractGradient = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/subtract-gradient.comp") });
+        Programs.ComputeDivergence = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/divergence.comp") });
+        Programs.ApplyImpulse = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/impulse.comp") });
+        Programs.ApplyBuoyancy = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/buoyancy.comp") });
+        Programs.ComputeVorticity = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/vorticity.comp") });
+        Programs.ApplyConfinement = makeProgram({ Shader(GL_COMPUTE_SHADER, "shaders/fluid/confinement.comp") });
+    }
+    else
+    {
+        Programs.Advect = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/advect.frag")
+        });
+
+        Programs.AdvectFused = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/advect-fused.frag")
+        });
+
+        Programs.AdvectMacCormack = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/advect-maccormack.frag")
+        });
+
+        glGenFramebuffers(1, &FusedFbo);
+
+        Programs.Jacobi = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/jacobi.frag")
+        });
+
+        Programs.RedBlackSOR = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/sor.frag")
+        });
+
+        Programs.SubtractGradient = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/subtract-gradient.frag")
+        });
+
+        Programs.ComputeDivergence = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/divergence.frag")
+        });
+
+        Programs.ApplyImpulse = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/impulse.frag")
+        });
+
+        Programs.ApplyBuoyancy = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/buoyancy.frag")
+        });
+
+        Programs.ComputeVorticity = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/vorticity.frag")
+        });
+
+        Programs.ApplyConfinement = makeProgram({
+            Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+            Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+            Shader(GL_FRAGMENT_SHADER, "shaders/fluid/confinement.frag")
+        });
+    }
+
+    Programs.Residual = makeProgram({
+        Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/residual.frag")
+    });
+
+    Programs.Restrict = makeProgram({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
-        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/advect.frag")
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/restrict.frag")
     });
 
-    Programs.Jacobi = makeProgram({
+    Programs.Prolongate = makeProgram({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
-        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/jacobi.frag")
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/prolongate.frag")
     });
 
-    Programs.SubtractGradient = makeProgram({
+    Programs.BrickActivity = makeProgram({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
-        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/subtract-gradient.frag")
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/brick-activity.frag")
     });
 
-    Programs.ComputeDivergence = makeProgram({
+    Programs.BrickDilate = makeProgram({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
-        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/divergence.frag")
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/brick-dilate.frag")
     });
 
-    Programs.ApplyImpulse = makeProgram({
+    Programs.ObstacleFlags = makeProgram({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
-        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/impulse.frag")
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/obstacle-flags.frag")
     });
 
-    Programs.ApplyBuoyancy = makeProgram({
+    Programs.DensityMax = makeProgram({
         Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
         Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
-        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/buoyancy.frag")
+        Shader(GL_FRAGMENT_SHADER, "shaders/raycast/density-max.frag")
+    });
+
+    Programs.MaxReduce = makeProgram({
+        Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/raycast/max-reduce.frag")
     });
 }
 
@@ -213,6 +350,14 @@ SlabPod CreateSlab(GLsizei width, GLsizei height, GLsizei depth, int numComponen
     return slab;
 }
 
+SlabPod CreateSlab(GLsizei width, GLsizei height, GLsizei depth, GLenum internalFormat)
+{
+    SlabPod slab;
+    slab.Ping = CreateVolumeWithFormat(width, height, depth, internalFormat);
+    slab.Pong = CreateVolumeWithFormat(width, height, depth, internalFormat);
+    return slab;
+}
+
 SurfacePod CreateSurface(GLsizei width, GLsizei height, int numComponents)
 {
     GLuint fboHandle;
@@ -227,25 +372,27 @@ SurfacePod CreateSurface(GLsizei width, GLsizei height, int numComponents)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    GLenum format = GL_R16F;
     switch (numComponents)
     {
         case 1:
+            format = GL_R16F;
             glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_HALF_FLOAT, 0);
             break;
         case 2:
+            format = GL_RG16F;
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_HALF_FLOAT, 0);
             break;
         case 3:
+            format = GL_RGB16F;
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_HALF_FLOAT, 0);
             break;
         case 4:
+            format = GL_RGBA16F;
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, 0);
             break;
     }
 
-    GLuint colorbuffer;
-    glGenRenderbuffers(1, &colorbuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureHandle, 0);
     
     SurfacePod surface = { fboHandle, textureHandle };
@@ -256,11 +403,119 @@ SurfacePod CreateSurface(GLsizei width, GLsizei height, int numComponents)
     surface.Width = width;
     surface.Height = height;
     surface.Depth = 1;
+    surface.Format = format;
+    return surface;
+}
+
+int MipLevelCount(GLsizei width, GLsizei height, GLsizei depth)
+{
+    int levels = 1;
+    for (GLsizei size = std::max(width, std::max(height, depth)); size > 1; size /= 2)
+    {
+        ++levels;
+    }
+    return levels;
+}
+
+// A single channel float volume with a full mip chain, for reductions written
+// one level at a time. Its framebuffer starts out attached to level 0.
+SurfacePod CreateMipVolume(GLsizei width, GLsizei height, GLsizei depth)
+{
+    int levels = MipLevelCount(width, height, depth);
+
+    GLuint textureHandle;
+    glGenTextures(1, &textureHandle);
+    glBindTexture(GL_TEXTURE_3D, textureHandle);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    // Without a mipmap min filter the upper levels would leave the texture
+    // incomplete and texelFetch from them would return zero
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    for (int level = 0; level < levels; ++level)
+    {
+        glTexImage3D(GL_TEXTURE_3D, level, GL_R16F, std::max(width >> level, 1), std::max(height >> level, 1),
+                     std::max(depth >> level, 1), 0, GL_RED, GL_HALF_FLOAT, 0);
+    }
+
+    GLuint fboHandle;
+    glGenFramebuffers(1, &fboHandle);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureHandle, 0);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    SurfacePod surface = { fboHandle, textureHandle, width, height, depth, GL_R16F };
+    return surface;
+}
+
+// A depth texture to blit a framebuffer's depth into and read back with
+// texelFetch. The window is multisampled, which rules out glCopyTexSubImage2D,
+// and a blit has to match the window's format: GLFW's default 24-bit depth
+// with 8-bit stencil.
+SurfacePod CreateDepthSurface(GLsizei width, GLsizei height)
+{
+    GLuint textureHandle;
+    glGenTextures(1, &textureHandle);
+    glBindTexture(GL_TEXTURE_2D, textureHandle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLuint fboHandle;
+    glGenFramebuffers(1, &fboHandle);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, textureHandle, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    SurfacePod surface = { fboHandle, textureHandle, width, height, 1, GL_DEPTH24_STENCIL8 };
     return surface;
 }
 
+// Format enums are plain ints, so they would land here rather than in
+// CreateVolumeWithFormat. Hence the separate name and the range check.
 SurfacePod CreateVolume(GLsizei width, GLsizei height, GLsizei depth, int numComponents)
 {
+    assert(numComponents >= 1 && numComponents <= 4);
+    const GLenum formats[] = { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F };
+    return CreateVolumeWithFormat(width, height, depth, formats[numComponents - 1]);
+}
+
+// Integer formats can't be filtered, so they get nearest sampling and are
+// meant to be read with texelFetch.
+SurfacePod CreateVolumeWithFormat(GLsizei width, GLsizei height, GLsizei depth, GLenum internalFormat)
+{
+    // Image load/store has no three channel formats, so the compute backend pads to RGBA
+    if (Backend == SolverBackend::Compute)
+    {
+        internalFormat = internalFormat == GL_RGB16F ? GL_RGBA16F : internalFormat == GL_RGB32F ? GL_RGBA32F : internalFormat;
+    }
+
+    GLenum format = GL_RED;
+    GLenum type = GL_HALF_FLOAT;
+    bool integer = false;
+    switch (internalFormat)
+    {
+        case GL_R8: type = GL_UNSIGNED_BYTE; break;
+        case GL_R32F: type = GL_FLOAT; break;
+        case GL_RG16F: format = GL_RG; break;
+        case GL_RG32F: format = GL_RG; type = GL_FLOAT; break;
+        case GL_RGB16F: format = GL_RGB; break;
+        case GL_RGB32F: format = GL_RGB; type = GL_FLOAT; break;
+        case GL_RGBA16F: format = GL_RGBA; break;
+        case GL_RGBA32F: format = GL_RGBA; type = GL_FLOAT; break;
+        case GL_R8UI: format = GL_RED_INTEGER; type = GL_UNSIGNED_BYTE; integer = true; break;
+    }
+
     GLuint fboHandle;
     glGenFramebuffers(1, &fboHandle);
     glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
@@ -271,41 +526,84 @@ SurfacePod CreateVolume(GLsizei width, GLsizei height, GLsizei depth, int numCom
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    switch (numComponents)
-    {
-        case 1:
-            glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, width, height, depth, 0, GL_RED, GL_HALF_FLOAT, 0);
-            break;
-        case 2:
-            glTexImage3D(GL_TEXTURE_3D, 0, GL_RG16F, width, height, depth, 0, GL_RG, GL_HALF_FLOAT, 0);
-            break;
-        case 3:
-            glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, width, height, depth, 0, GL_RGB, GL_HALF_FLOAT, 0);
-            break;
-        case 4:
-            glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, width, height, depth, 0, GL_RGBA, GL_HALF_FLOAT, 0);
-            break;
-    }
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, integer ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, integer ? GL_NEAREST : GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, width, height, depth, 0, format, type, 0);
 
-    GLuint colorbuffer;
-    glGenRenderbuffers(1, &colorbuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureHandle, 0);
 
     SurfacePod surface = { fboHandle, textureHandle };
 
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    if (integer)
+    {
+        const GLuint zero[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, zero);
+    }
+    else
+    {
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     surface.Width = width;
     surface.Height = height;
     surface.Depth = depth;
+    surface.Format = internalFormat;
     return surface;
 }
 
+void DestroySurface(SurfacePod surface)
+{
+    glDeleteFramebuffers(1, &surface.FboHandle);
+    glDeleteTextures(1, &surface.ColorTexture);
+}
+
+void DestroySlab(SlabPod slab)
+{
+    DestroySurface(slab.Ping);
+    DestroySurface(slab.Pong);
+}
+
+const char* FormatName(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_R8: return "R8";
+        case GL_R8UI: return "R8UI";
+        case GL_R16F: return "R16F";
+        case GL_R32F: return "R32F";
+        case GL_RG16F: return "RG16F";
+        case GL_RG32F: return "RG32F";
+        case GL_RGB16F: return "RGB16F";
+        case GL_RGB32F: return "RGB32F";
+        case GL_RGBA16F: return "RGBA16F";
+        case GL_RGBA32F: return "RGBA32F";
+        case GL_DEPTH24_STENCIL8: return "DEPTH24_STENCIL8";
+    }
+    return "?";
+}
+
+// Video memory taken by a surface's base level. Drivers generally store three
+// channel formats as four, so they are counted that way.
+size_t SurfaceBytes(SurfacePod surface)
+{
+    size_t texel = 4;
+    switch (surface.Format)
+    {
+        case GL_R8: case GL_R8UI: texel = 1; break;
+        case GL_R16F: texel = 2; break;
+        case GL_R32F: case GL_RG16F: case GL_DEPTH24_STENCIL8: texel = 4; break;
+        case GL_RG32F: case GL_RGB16F: case GL_RGBA16F: texel = 8; break;
+        case GL_RGB32F: case GL_RGBA32F: texel = 16; break;
+    }
+    return size_t(surface.Width) * surface.Height * surface.Depth * texel;
+}
+
+size_t SlabBytes(SlabPod slab)
+{
+    return SurfaceBytes(slab.Ping) + SurfaceBytes(slab.Pong);
+}
+
 GLuint CreateQuadVbo()
 {
     short positions[] = {
@@ -322,50 +620,360 @@ GLuint CreateQuadVbo()
     return vbo;
 }
 
-void Advect(SurfacePod velocity, SurfacePod source, SurfacePod obstacles, SurfacePod dest, float dissipation)
+SolverBackend GetSolverBackend()
+{
+    return Backend;
+}
+
+const char* SolverBackendName(SolverBackend backend)
+{
+    switch (backend)
+    {
+        case SolverBackend::Compute: return "compute";
+        case SolverBackend::Cpu: return "cpu";
+        default: return "fragment";
+    }
+}
+
+void SetSimulationSettings(const SimulationSettings& settings)
+{
+    Settings = settings;
+}
+
+const SimulationSettings& GetSimulationSettings()
+{
+    return Settings;
+}
+
+// Runs the bound slab program over every voxel of dest, either as one
+// instanced quad per layer or as a compute dispatch writing through an image.
+static void DrawSlab(SurfacePod dest, GLenum access)
+{
+    if (Backend == SolverBackend::Compute)
+    {
+        glBindImageTexture(0, dest.ColorTexture, 0, GL_TRUE, 0, access, dest.Format);
+        glDispatchCompute((dest.Width + 7) / 8, (dest.Height + 7) / 8, (dest.Depth + 7) / 8);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16F);
+        return;
+    }
+
+    // Velocity and density can have different resolutions, so each pass sizes its own viewport
+    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+    glViewport(0, 0, dest.Width, dest.Height);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+}
+
+// Velocity is stored in cells of its own grid, so tracing through a finer
+// destination has to stretch the step by the ratio between the two.
+static float GridScale(SurfacePod velocity, SurfacePod dest)
+{
+    return float(dest.Width) / float(velocity.Width);
+}
+
+void SetBrickMask(SurfacePod mask)
+{
+    BrickMaskTexture = mask.ColorTexture;
+}
+
+void SetObstacleVelocity(SurfacePod velocity)
+{
+    ObstacleVelocityTexture = velocity.ColorTexture;
+}
+
+static void BindObstacleVelocity(GLuint pid)
+{
+    SetUniform(pid, "ObstacleVelocity", 5);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, ObstacleVelocityTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void BindBrickMask(GLuint pid)
+{
+    SetUniform(pid, "BrickMask", 4);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, BrickMaskTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Flags every brick that holds smoke, heat or motion, then grows that set by one
+// brick so this step's advection and pressure solve have room to spread into.
+void UpdateBrickMask(SurfacePod density, SurfacePod temperature, SurfacePod velocity, SurfacePod activity, SurfacePod mask, float threshold)
+{
+    glViewport(0, 0, mask.Width, mask.Height);
+
+    GLuint pid = Programs.BrickActivity;
+    glUseProgram(pid);
+    SetUniform(pid, "Threshold", threshold);
+    SetUniform(pid, "AmbientTemperature", AmbientTemperature);
+    SetUniform(pid, "Density", 0);
+    SetUniform(pid, "Temperature", 1);
+    SetUniform(pid, "Velocity", 2);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, activity.FboHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, density.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, temperature.ColorTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
+    BindObstacleVelocity(pid);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, activity.Depth);
+    ResetState();
+
+    pid = Programs.BrickDilate;
+    glUseProgram(pid);
+    SetUniform(pid, "Activity", 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mask.FboHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, activity.ColorTexture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, mask.Depth);
+    ResetState();
+
+    SetBrickMask(mask);
+}
+
+static void AdvectStep(SurfacePod velocity, SurfacePod source, SurfacePod obstacles, SurfacePod dest, float dissipation, float timeStep)
 {
     GLuint pid = Programs.Advect;
     glUseProgram(pid);
-    SetUniform(pid, "InverseSize", 1.0f / glm::vec3(GridWidth, GridHeight, GridDepth));
-    SetUniform(pid, "TimeStep", TimeStep);
+    SetUniform(pid, "InverseSize", 1.0f / glm::vec3(dest.Width, dest.Height, dest.Depth));
+    SetUniform(pid, "TimeStep", timeStep);
     SetUniform(pid, "Dissipation", dissipation);
     SetUniform(pid, "VelocityTexture", 0);
     SetUniform(pid, "SourceTexture", 1);
     SetUniform(pid, "Obstacles", 2);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, source.ColorTexture);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
+
+    ResetState();
+}
+
+void Advect(SurfacePod velocity, SurfacePod source, SurfacePod obstacles, SurfacePod dest, float dissipation)
+{
+    AdvectStep(velocity, source, obstacles, dest, dissipation, Settings.TimeStep * GridScale(velocity, dest));
+}
+
+// Advects forward into one scratch volume and back again into the other, then
+// uses the round trip's error to correct the forward result. The scratch
+// volumes need at least as many components as the source and its resolution.
+void AdvectMacCormack(SurfacePod velocity, SurfacePod source, SurfacePod obstacles, SurfacePod dest,
+                      SurfacePod forward, SurfacePod backward, float dissipation)
+{
+    float timeStep = Settings.TimeStep * GridScale(velocity, dest);
+    AdvectStep(velocity, source, obstacles, forward, 1.0f, timeStep);
+    AdvectStep(velocity, forward, obstacles, backward, 1.0f, -timeStep);
+
+    GLuint pid = Programs.AdvectMacCormack;
+    glUseProgram(pid);
+    SetUniform(pid, "InverseSize", 1.0f / glm::vec3(dest.Width, dest.Height, dest.Depth));
+    SetUniform(pid, "TimeStep", timeStep);
+    SetUniform(pid, "Dissipation", dissipation);
+    SetUniform(pid, "VelocityTexture", 0);
+    SetUniform(pid, "SourceTexture", 1);
+    SetUniform(pid, "ForwardTexture", 2);
+    SetUniform(pid, "BackwardTexture", 3);
+    SetUniform(pid, "Obstacles", 5);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, source.ColorTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, forward.ColorTexture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_3D, backward.ColorTexture);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
+
+    ResetState();
+}
+
+void AdvectFused(SurfacePod velocity, SurfacePod temperature, SurfacePod density, SurfacePod obstacles,
+                 SurfacePod velocityDest, SurfacePod temperatureDest, SurfacePod densityDest, glm::vec3 dissipation)
+{
+    GLuint pid = Programs.AdvectFused;
+    glUseProgram(pid);
+    SetUniform(pid, "InverseSize", 1.0f / glm::vec3(densityDest.Width, densityDest.Height, densityDest.Depth));
+    SetUniform(pid, "TimeStep", Settings.TimeStep);
+    SetUniform(pid, "Dissipation", dissipation);
+    SetUniform(pid, "VelocityTexture", 0);
+    SetUniform(pid, "TemperatureTexture", 1);
+    SetUniform(pid, "DensityTexture", 2);
+    SetUniform(pid, "Obstacles", 3);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, temperature.ColorTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, density.ColorTexture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
+    BindBrickMask(pid);
+
+    if (Backend == SolverBackend::Compute)
+    {
+        glBindImageTexture(0, velocityDest.ColorTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, velocityDest.Format);
+        glBindImageTexture(1, temperatureDest.ColorTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, temperatureDest.Format);
+        glBindImageTexture(2, densityDest.ColorTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, densityDest.Format);
+        glDispatchCompute((densityDest.Width + 7) / 8, (densityDest.Height + 7) / 8, (densityDest.Depth + 7) / 8);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    }
+    else
+    {
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FusedFbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, velocityDest.ColorTexture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, temperatureDest.ColorTexture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, densityDest.ColorTexture, 0);
+        glDrawBuffers(3, drawBuffers);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, densityDest.Depth);
+    }
 
     ResetState();
 }
 
-void Jacobi(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest)
+void Jacobi(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest, float cellSize, float omega)
 {
     GLuint pid = Programs.Jacobi;
     glUseProgram(pid);
+    SetUniform(pid, "Alpha", -cellSize * cellSize);
+    SetUniform(pid, "InverseBeta", 0.1666f);
+    SetUniform(pid, "Omega", omega);
+    SetUniform(pid, "Pressure", 0);
+    SetUniform(pid, "Divergence", 1);
+    SetUniform(pid, "Obstacles", 2);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, pressure.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, divergence.ColorTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
+    ResetState();
+}
+
+void RedBlackSOR(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest, float omega, int parity)
+{
+    GLuint pid = Programs.RedBlackSOR;
+    glUseProgram(pid);
     SetUniform(pid, "Alpha", -CellSize * CellSize);
     SetUniform(pid, "InverseBeta", 0.1666f);
+    SetUniform(pid, "Omega", omega);
+    SetUniform(pid, "Parity", parity);
     SetUniform(pid, "Pressure", 0);
     SetUniform(pid, "Divergence", 1);
     SetUniform(pid, "Obstacles", 2);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, pressure.ColorTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, divergence.ColorTexture);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
     ResetState();
 }
 
+// Residual checks on their way back from the GPU, oldest first. Each one
+// waits in its own pixel pack buffer behind a fence, so asking never stalls.
+static const int ResidualRingSize = 16;
+static struct {
+    GLuint Buffers[ResidualRingSize];
+    GLsync Fences[ResidualRingSize];
+    ResidualCheck Checks[ResidualRingSize];
+    int Head;       // next slot to fill
+    int Pending;    // slots filled but not yet taken
+} ResidualReadback;
+
+// Averages the squared residual down to a single texel with the driver's mip
+// generation and copies that texel into a buffer, to be picked up by
+// PollResidualNorm once the GPU gets there. The residual is RG32F: half floats
+// lose the small squared terms long before the tolerance is reached, and
+// every mip level of the reduction keeps the same precision.
+void RequestResidualNorm(SurfacePod residual, ResidualCheck check)
+{
+    if (!ResidualReadback.Buffers[0])
+    {
+        glGenBuffers(ResidualRingSize, ResidualReadback.Buffers);
+        for (GLuint buffer : ResidualReadback.Buffers)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, 2 * sizeof(float), nullptr, GL_STREAM_READ);
+        }
+    }
+
+    // Drop the check rather than reuse a buffer the GPU hasn't written yet
+    if (ResidualReadback.Pending == ResidualRingSize)
+    {
+        return;
+    }
+
+    GLsizei size = std::max(residual.Width, std::max(residual.Height, residual.Depth));
+    GLint topLevel = 0;
+    while (size > 1)
+    {
+        size >>= 1;
+        ++topLevel;
+    }
+
+    int slot = ResidualReadback.Head;
+    glBindTexture(GL_TEXTURE_3D, residual.ColorTexture);
+    glGenerateMipmap(GL_TEXTURE_3D);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ResidualReadback.Buffers[slot]);
+    glGetTexImage(GL_TEXTURE_3D, topLevel, GL_RG, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    ResidualReadback.Fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ResidualReadback.Checks[slot] = check;
+    ResidualReadback.Head = (slot + 1) % ResidualRingSize;
+    ++ResidualReadback.Pending;
+}
+
+bool PollResidualNorm(ResidualCheck* check)
+{
+    if (ResidualReadback.Pending == 0)
+    {
+        return false;
+    }
+
+    // A zero timeout only asks; the flush makes sure the fence gets to the GPU
+    int slot = (ResidualReadback.Head - ResidualReadback.Pending + ResidualRingSize) % ResidualRingSize;
+    GLenum status = glClientWaitSync(ResidualReadback.Fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+        return false;
+    }
+    glDeleteSync(ResidualReadback.Fences[slot]);
+
+    float texel[2] = { 0, 0 };
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ResidualReadback.Buffers[slot]);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(texel), texel);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    *check = ResidualReadback.Checks[slot];
+    check->Norm = sqrtf(texel[1]);
+    --ResidualReadback.Pending;
+    return true;
+}
+
 void SubtractGradient(SurfacePod velocity, SurfacePod pressure, SurfacePod obstacles, SurfacePod dest)
 {
     GLuint pid = Programs.SubtractGradient;
@@ -376,14 +984,15 @@ void SubtractGradient(SurfacePod velocity, SurfacePod pressure, SurfacePod obsta
     SetUniform(pid, "Pressure", 1);
     SetUniform(pid, "Obstacles", 2);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, pressure.ColorTexture);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    BindObstacleVelocity(pid);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
     ResetState();
 }
 
@@ -395,12 +1004,13 @@ void ComputeDivergence(SurfacePod velocity, SurfacePod obstacles, SurfacePod des
     SetUniform(pid, "Velocity", 0);
     SetUniform(pid, "Obstacles", 1);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    BindObstacleVelocity(pid);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
     ResetState();
 }
 
@@ -409,12 +1019,19 @@ void ApplyImpulse(SurfacePod dest, glm::vec3 position, float value)
     GLuint pid = Programs.ApplyImpulse;
     glUseProgram(pid);
     SetUniform(pid, "Point", position);
-    SetUniform(pid, "Radius", SplatRadius);
+    SetUniform(pid, "Radius", Settings.SplatRadius);
     SetUniform(pid, "FillColor", glm::vec3(value));
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+    // The compute shader reads the field through a sampler, which works with any format
+    if (Backend == SolverBackend::Compute)
+    {
+        SetUniform(pid, "Source", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, dest.ColorTexture);
+    }
+
     glEnable(GL_BLEND);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    DrawSlab(dest, GL_WRITE_ONLY);
     ResetState();
 }
 
@@ -426,21 +1043,306 @@ void ApplyBuoyancy(SurfacePod velocity, SurfacePod temperature, SurfacePod densi
     SetUniform(pid, "Temperature", 1);
     SetUniform(pid, "Density", 2);
     SetUniform(pid, "AmbientTemperature", AmbientTemperature);
-    SetUniform(pid, "TimeStep", TimeStep);
+    SetUniform(pid, "TimeStep", Settings.TimeStep);
     SetUniform(pid, "Sigma", SmokeBuoyancy);
     SetUniform(pid, "Kappa", SmokeWeight);
+    SetUniform(pid, "VelocityScale", GridScale(density, velocity));
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, temperature.ColorTexture);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_3D, density.ColorTexture);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
+    ResetState();
+}
+
+void ComputeVorticity(SurfacePod velocity, SurfacePod obstacles, SurfacePod dest)
+{
+    GLuint pid = Programs.ComputeVorticity;
+    glUseProgram(pid);
+    SetUniform(pid, "HalfInverseCellSize", 0.5f / CellSize);
+    SetUniform(pid, "Velocity", 0);
+    SetUniform(pid, "Obstacles", 1);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
+    ResetState();
+}
+
+// Adds back the small-scale rotation that the grid and advection damp out.
+// Epsilon scales the force; zero leaves the velocity unchanged.
+void ApplyVorticityConfinement(SurfacePod velocity, SurfacePod vorticity, SurfacePod obstacles, SurfacePod dest, float epsilon)
+{
+    GLuint pid = Programs.ApplyConfinement;
+    glUseProgram(pid);
+    SetUniform(pid, "HalfInverseCellSize", 0.5f / CellSize);
+    SetUniform(pid, "CellSize", CellSize);
+    SetUniform(pid, "TimeStep", Settings.TimeStep);
+    SetUniform(pid, "Epsilon", epsilon);
+    SetUniform(pid, "Velocity", 0);
+    SetUniform(pid, "Vorticity", 1);
+    SetUniform(pid, "Obstacles", 2);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, velocity.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, vorticity.ColorTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
+    BindBrickMask(pid);
+    DrawSlab(dest, GL_WRITE_ONLY);
+    ResetState();
+}
+
+std::vector<MultigridLevel> CreateMultigrid(GLsizei width, GLsizei height, GLsizei depth, int numLevels)
+{
+    std::vector<MultigridLevel> levels(numLevels);
+
+    for (int level = 0; level < numLevels; ++level)
+    {
+        GLsizei w = std::max(width >> level, 1);
+        GLsizei h = std::max(height >> level, 1);
+        GLsizei d = std::max(depth >> level, 1);
+
+        MultigridLevel& l = levels[level];
+        l.CellSize = CellSize * float(1 << level);
+
+        // The finest level borrows the simulation's own pressure, divergence and obstacles
+        if (level > 0)
+        {
+            l.Pressure = CreateSlab(w, h, d, Settings.PressureFormat);
+            l.Divergence = CreateVolumeWithFormat(w, h, d, Settings.PressureFormat);
+            l.Obstacles = CreateVolumeWithFormat(w, h, d, GL_R8UI);
+            l.Solid = CreateVolumeWithFormat(w, h, d, GL_R8);
+        }
+
+        if (level < numLevels - 1)
+        {
+            l.Residual = CreateVolumeWithFormat(w, h, d, GL_RG32F);
+        }
+    }
+
+    return levels;
+}
+
+void DestroyMultigrid(std::vector<MultigridLevel>& levels)
+{
+    for (size_t level = 0; level < levels.size(); ++level)
+    {
+        MultigridLevel& l = levels[level];
+        if (level > 0)
+        {
+            DestroySlab(l.Pressure);
+            DestroySurface(l.Divergence);
+            DestroySurface(l.Obstacles);
+            DestroySurface(l.Solid);
+        }
+
+        if (level < levels.size() - 1)
+        {
+            DestroySurface(l.Residual);
+        }
+    }
+
+    levels.clear();
+}
+
+// Packs a float volume that is non-zero inside obstacles into the per-voxel
+// flags the solver reads: bit 6 for the voxel itself and bits 0-5 for its
+// +y, -y, +x, -x, +z and -z neighbours.
+void BuildObstacleFlags(SurfacePod solid, SurfacePod dest)
+{
+    GLuint pid = Programs.ObstacleFlags;
+    glUseProgram(pid);
+    SetUniform(pid, "Source", 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+    glViewport(0, 0, dest.Width, dest.Height);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, solid.ColorTexture);
     glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
     ResetState();
 }
 
+// Takes the solid mask the finest level's flags were built from.
+void RestrictObstacles(SurfacePod solid, std::vector<MultigridLevel>& levels)
+{
+    SurfacePod fine = solid;
+    for (size_t level = 1; level < levels.size(); ++level)
+    {
+        const MultigridLevel& l = levels[level];
+        glViewport(0, 0, l.Solid.Width, l.Solid.Height);
+
+        // A coarse cell is solid when any of its children is. Taking the max
+        // rather than the average keeps that exact in an 8-bit volume.
+        GLuint pid = Programs.MaxReduce;
+        glUseProgram(pid);
+        SetUniform(pid, "Source", 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, l.Solid.FboHandle);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, fine.ColorTexture);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, l.Solid.Depth);
+        ResetState();
+
+        BuildObstacleFlags(l.Solid, l.Obstacles);
+        fine = l.Solid;
+    }
+}
+
+// Fills level 0 of the pyramid with the largest density in each brick, then
+// every level above with the largest of the eight texels below it. Rays use it
+// to jump over space with no smoke in it.
+void BuildDensityPyramid(SurfacePod density, SurfacePod pyramid)
+{
+    int levels = MipLevelCount(pyramid.Width, pyramid.Height, pyramid.Depth);
+
+    GLuint pid = Programs.DensityMax;
+    glUseProgram(pid);
+    SetUniform(pid, "Density", 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pyramid.FboHandle);
+    glViewport(0, 0, pyramid.Width, pyramid.Height);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, density.ColorTexture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, pyramid.Depth);
+
+    pid = Programs.MaxReduce;
+    glUseProgram(pid);
+    SetUniform(pid, "Source", 0);
+    glBindTexture(GL_TEXTURE_3D, pyramid.ColorTexture);
+
+    // Narrowing the sampler to the level being read keeps it apart from the one being drawn
+    for (int level = 1; level < levels; ++level)
+    {
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, pyramid.ColorTexture, level);
+        glViewport(0, 0, std::max(pyramid.Width >> level, 1), std::max(pyramid.Height >> level, 1));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, std::max(pyramid.Depth >> level, 1));
+    }
+
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, pyramid.ColorTexture, 0);
+    ResetState();
+}
+
+void ComputeResidual(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest, float cellSize)
+{
+    GLuint pid = Programs.Residual;
+    glUseProgram(pid);
+    SetUniform(pid, "InverseCellSizeSquared", 1.0f / (cellSize * cellSize));
+    SetUniform(pid, "Pressure", 0);
+    SetUniform(pid, "Divergence", 1);
+    SetUniform(pid, "Obstacles", 2);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, pressure.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, divergence.ColorTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, obstacles.ColorTexture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    ResetState();
+}
+
+void Restrict(SurfacePod fine, SurfacePod dest)
+{
+    GLuint pid = Programs.Restrict;
+    glUseProgram(pid);
+    SetUniform(pid, "InverseSize", 1.0f / glm::vec3(dest.Width, dest.Height, dest.Depth));
+    SetUniform(pid, "Source", 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, fine.ColorTexture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    ResetState();
+}
+
+void Prolongate(SurfacePod pressure, SurfacePod correction, SurfacePod dest)
+{
+    GLuint pid = Programs.Prolongate;
+    glUseProgram(pid);
+    SetUniform(pid, "InverseSize", 1.0f / glm::vec3(dest.Width, dest.Height, dest.Depth));
+    SetUniform(pid, "Pressure", 0);
+    SetUniform(pid, "Correction", 1);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dest.FboHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, pressure.ColorTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, correction.ColorTexture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, dest.Depth);
+    ResetState();
+}
+
+static void VCycleLevel(std::vector<MultigridLevel>& levels, size_t level)
+{
+    MultigridLevel& fine = levels[level];
+    glViewport(0, 0, fine.Pressure.Ping.Width, fine.Pressure.Ping.Height);
+
+    // The coarsest grid is tiny, so just relax it until it is close enough
+    if (level + 1 == levels.size())
+    {
+        for (int i = 0; i < NumCoarseIterations; ++i)
+        {
+            Jacobi(fine.Pressure.Ping, fine.Divergence, fine.Obstacles, fine.Pressure.Pong, fine.CellSize, SmootherWeight);
+            SwapSurfaces(&fine.Pressure);
+        }
+        return;
+    }
+
+    for (int i = 0; i < NumSmoothingIterations; ++i)
+    {
+        Jacobi(fine.Pressure.Ping, fine.Divergence, fine.Obstacles, fine.Pressure.Pong, fine.CellSize, SmootherWeight);
+        SwapSurfaces(&fine.Pressure);
+    }
+
+    // Solve for the error on the next grid down, using the residual as its right hand side
+    MultigridLevel& coarse = levels[level + 1];
+    ComputeResidual(fine.Pressure.Ping, fine.Divergence, fine.Obstacles, fine.Residual, fine.CellSize);
+
+    glViewport(0, 0, coarse.Divergence.Width, coarse.Divergence.Height);
+    Restrict(fine.Residual, coarse.Divergence);
+
+    // The coarse grids solve for a correction, which starts at zero and stays
+    // zero through inactive bricks
+    ClearSurface(coarse.Pressure.Ping, 0);
+
+    VCycleLevel(levels, level + 1);
+
+    glViewport(0, 0, fine.Pressure.Ping.Width, fine.Pressure.Ping.Height);
+    Prolongate(fine.Pressure.Ping, coarse.Pressure.Ping, fine.Pressure.Pong);
+    SwapSurfaces(&fine.Pressure);
+
+    for (int i = 0; i < NumSmoothingIterations; ++i)
+    {
+        Jacobi(fine.Pressure.Ping, fine.Divergence, fine.Obstacles, fine.Pressure.Pong, fine.CellSize, SmootherWeight);
+        SwapSurfaces(&fine.Pressure);
+    }
+}
+
+void VCycle(SlabPod* pressure, SurfacePod divergence, SurfacePod obstacles, std::vector<MultigridLevel>& levels)
+{
+    MultigridLevel& finest = levels[0];
+    finest.Pressure = *pressure;
+    finest.Divergence = divergence;
+    finest.Obstacles = obstacles;
+
+    VCycleLevel(levels, 0);
+
+    *pressure = finest.Pressure;
+}
+
 void SwapSurfaces(SlabPod* slab)
 {
     SurfacePod temp = slab->Ping;
@@ -457,6 +1359,9 @@ void ClearSurface(SurfacePod s, float v)
 
 void ResetState()
 {
+    glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_3D, 0);
     glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_3D, 0);
     glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_3D, 0);
     glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_3D, 0);
@@ -7,6 +7,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <map>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <assert.h>
@@ -27,6 +28,7 @@ struct SurfacePod {
     GLsizei Width;
     GLsizei Height;
     GLsizei Depth;
+    GLenum Format;
 };
 
 struct SlabPod {
@@ -34,6 +36,45 @@ struct SlabPod {
     SurfacePod Pong;
 };
 
+struct MultigridLevel {
+    SlabPod Pressure;
+    SurfacePod Divergence;
+    SurfacePod Obstacles;
+    SurfacePod Solid;       // R8 solid mask the coarse Obstacles are built from
+    SurfacePod Residual;
+    float CellSize;
+};
+
+// Everything about the simulation that can change at runtime without
+// recompiling. Grid dimensions are kept to multiples of BrickSize.
+struct SimulationSettings {
+    GLsizei GridWidth;
+    GLsizei GridHeight;
+    GLsizei GridDepth;
+    int NumJacobiIterations;
+    float TimeStep;
+    float SplatRadius;
+    int VelocityDownsample;     // 1 shares the grid, 2 runs velocity and pressure at half resolution
+    GLenum VelocityFormat;      // internal format of each field's volumes
+    GLenum DensityFormat;
+    GLenum TemperatureFormat;
+    GLenum PressureFormat;      // also used for the divergence and the multigrid's coarse levels
+};
+
+// One residual norm read back from the GPU, tagged with where in the solve
+// it was taken
+struct ResidualCheck {
+    int Step;           // simulation step it belongs to
+    int Iterations;     // solver iterations done before it
+    float Norm;
+};
+
+enum class SolverBackend {
+    Fragment,   // instanced quads routed to layers by pick-layer.gs
+    Compute,    // GL 4.3 compute shaders writing through image load/store
+    Cpu         // threaded CPU solver in cpusolver.cpp, density uploaded for rendering
+};
+
 GLuint makeProgram(std::initializer_list<Shader> shaders);
 
 GLuint CreatePointVbo(float x, float y, float z);
@@ -41,17 +82,56 @@ GLuint CreateQuadVbo();
 
 void CreateObstacles(SurfacePod dest);
 SlabPod CreateSlab(GLsizei width, GLsizei height, GLsizei depth, int numComponents);
+SlabPod CreateSlab(GLsizei width, GLsizei height, GLsizei depth, GLenum internalFormat);
+SurfacePod CreateSurface(GLsizei width, GLsizei height, int numComponents);
+SurfacePod CreateDepthSurface(GLsizei width, GLsizei height);
+SurfacePod CreateMipVolume(GLsizei width, GLsizei height, GLsizei depth);
+int MipLevelCount(GLsizei width, GLsizei height, GLsizei depth);
 SurfacePod CreateVolume(GLsizei width, GLsizei height, GLsizei depth, int numComponents);
+SurfacePod CreateVolumeWithFormat(GLsizei width, GLsizei height, GLsizei depth, GLenum internalFormat);
+void DestroySurface(SurfacePod surface);
+void DestroySlab(SlabPod slab);
+const char* FormatName(GLenum internalFormat);
+size_t SurfaceBytes(SurfacePod surface);
+size_t SlabBytes(SlabPod slab);
 
-void InitializeSlabPrograms();
+void InitializeSlabPrograms(SolverBackend backend);
+SolverBackend GetSolverBackend();
+const char* SolverBackendName(SolverBackend backend);
+void SetSimulationSettings(const SimulationSettings& settings);
+const SimulationSettings& GetSimulationSettings();
 void SwapSurfaces(SlabPod* slab);
 void ClearSurface(SurfacePod s, float v);
 void Advect(SurfacePod velocity, SurfacePod source, SurfacePod obstacles, SurfacePod dest, float dissipation);
-void Jacobi(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest);
+void AdvectMacCormack(SurfacePod velocity, SurfacePod source, SurfacePod obstacles, SurfacePod dest,
+                      SurfacePod forward, SurfacePod backward, float dissipation);
+void AdvectFused(SurfacePod velocity, SurfacePod temperature, SurfacePod density, SurfacePod obstacles,
+                 SurfacePod velocityDest, SurfacePod temperatureDest, SurfacePod densityDest, glm::vec3 dissipation);
+void Jacobi(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest, float cellSize, float omega);
+void RedBlackSOR(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest, float omega, int parity);
+void RequestResidualNorm(SurfacePod residual, ResidualCheck check);
+bool PollResidualNorm(ResidualCheck* check);
 void SubtractGradient(SurfacePod velocity, SurfacePod pressure, SurfacePod obstacles, SurfacePod dest);
 void ComputeDivergence(SurfacePod velocity, SurfacePod obstacles, SurfacePod dest);
 void ApplyImpulse(SurfacePod dest, glm::vec3 position, float value);
 void ApplyBuoyancy(SurfacePod velocity, SurfacePod temperature, SurfacePod density, SurfacePod dest);
+void ComputeVorticity(SurfacePod velocity, SurfacePod obstacles, SurfacePod dest);
+void ApplyVorticityConfinement(SurfacePod velocity, SurfacePod vorticity, SurfacePod obstacles, SurfacePod dest, float epsilon);
+
+std::vector<MultigridLevel> CreateMultigrid(GLsizei width, GLsizei height, GLsizei depth, int numLevels);
+void DestroyMultigrid(std::vector<MultigridLevel>& levels);
+void BuildObstacleFlags(SurfacePod solid, SurfacePod dest);
+void RestrictObstacles(SurfacePod solid, std::vector<MultigridLevel>& levels);
+void ComputeResidual(SurfacePod pressure, SurfacePod divergence, SurfacePod obstacles, SurfacePod dest, float cellSize);
+void Restrict(SurfacePod fine, SurfacePod dest);
+void Prolongate(SurfacePod pressure, SurfacePod correction, SurfacePod dest);
+void VCycle(SlabPod* pressure, SurfacePod divergence, SurfacePod obstacles, std::vector<MultigridLevel>& levels);
+
+void UpdateBrickMask(SurfacePod density, SurfacePod temperature, SurfacePod velocity, SurfacePod activity, SurfacePod mask, float threshold);
+void SetBrickMask(SurfacePod mask);
+void BindBrickMask(GLuint pid);
+void BuildDensityPyramid(SurfacePod density, SurfacePod pyramid);
+void SetObstacleVelocity(SurfacePod velocity);
 
 GLuint getUniformLocation(GLuint program, const char* name);
 void SetUniform(GLuint program, const char* name, int value);
@@ -69,14 +149,16 @@ bool checkError();
 extern const float CellSize;
 extern const int ViewportWidth;
 extern const int ViewportHeight;
-extern const int GridWidth;
-extern const int GridHeight;
-extern const int GridDepth;
-extern const float SplatRadius;
 extern const float AmbientTemperature;
-extern const int NumJacobiIterations;
-extern const float TimeStep;
+extern const int NumMultigridLevels;
+extern const int NumVCycles;
+extern const int NumSmoothingIterations;
+extern const int NumCoarseIterations;
+extern const float SmootherWeight;
+extern const int ResidualCheckInterval;
+extern const int BrickSize;
+extern const float BrickThreshold;
+extern const SimulationSettings DefaultSimulationSettings;
 extern const float SmokeBuoyancy;
 extern const float SmokeWeight;
 extern const float GradientScale;
-extern const glm::vec3 ImpulsePosition;
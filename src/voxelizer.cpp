@@ -0,0 +1,207 @@
+#include "voxelizer.h"
+
+#include <cstdio>
+#include <string>
+
+void ObstacleVoxelizer::initialize()
+{
+    voxelizeProgram = makeProgram({
+        Shader(GL_VERTEX_SHADER, "shaders/fluid/voxelize.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/fluid/voxelize.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/voxelize.frag")
+    });
+
+    compositeProgram = makeProgram({
+        Shader(GL_VERTEX_SHADER, "shaders/fluid/fluid.vert"),
+        Shader(GL_GEOMETRY_SHADER, "shaders/fluid/pick-layer.gs"),
+        Shader(GL_FRAGMENT_SHADER, "shaders/fluid/obstacle-composite.frag")
+    });
+
+    glGenFramebuffers(1, &compositeFbo);
+}
+
+void ObstacleVoxelizer::destroy()
+{
+    for (auto& entry : entries)
+    {
+        if (entry.Mask.ColorTexture)
+        {
+            DestroySurface(entry.Mask);
+        }
+    }
+    entries.clear();
+
+    glDeleteProgram(voxelizeProgram);
+    glDeleteProgram(compositeProgram);
+    glDeleteFramebuffers(1, &compositeFbo);
+}
+
+void ObstacleVoxelizer::add(Object* object)
+{
+    Entry entry = {};
+    entry.Source = object;
+    entry.Current = entry.Previous = object->getModelMatrix();
+    entries.push_back(entry);
+}
+
+// Masks are only kept for enabled objects, and are drawn on the next update.
+void ObstacleVoxelizer::setEnabled(size_t index, bool value)
+{
+    Entry& entry = entries[index];
+    if (entry.Enabled == value)
+    {
+        return;
+    }
+
+    int count = 0;
+    for (auto& e : entries)
+    {
+        count += e.Enabled ? 1 : 0;
+    }
+    if (value && count == MaxObjects)
+    {
+        printf("At most %d objects can be obstacles at once\n", MaxObjects);
+        return;
+    }
+
+    if (!value && entry.Mask.ColorTexture)
+    {
+        DestroySurface(entry.Mask);
+        entry.Mask = SurfacePod();
+    }
+
+    entry.Enabled = value;
+    dirty = true;
+}
+
+bool ObstacleVoxelizer::update(const glm::mat4& worldToVolume, GLsizei width, GLsizei height, GLsizei depth)
+{
+    bool moved = worldToVolume != volumeTransform;
+    volumeTransform = worldToVolume;
+
+    bool changed = dirty;
+    dirty = false;
+
+    for (auto& entry : entries)
+    {
+        entry.Previous = entry.Current;
+        entry.Current = entry.Source->getModelMatrix();
+        if (!entry.Enabled)
+        {
+            continue;
+        }
+
+        bool resized = entry.Mask.Width != width || entry.Mask.Height != height || entry.Mask.Depth != depth;
+        if (resized)
+        {
+            if (entry.Mask.ColorTexture)
+            {
+                DestroySurface(entry.Mask);
+            }
+            entry.Mask = CreateVolumeWithFormat(width, height, depth, GL_R8UI);
+        }
+
+        if (resized || moved || entry.Current != entry.Voxelized)
+        {
+            voxelize(entry);
+            changed = true;
+        }
+
+        bool moving = entry.Current != entry.Previous;
+        changed |= moving || entry.Moving;
+        entry.Moving = moving;
+    }
+
+    return changed;
+}
+
+bool ObstacleVoxelizer::moving() const
+{
+    for (auto& entry : entries)
+    {
+        if (entry.Enabled && entry.Moving)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Draws the whole mesh once per slice with an orthographic projection down z.
+// Each slice keeps only the fragments beyond its centre and XORs them into the
+// mask, leaving an odd count, and so a set low bit, inside the mesh. Meshes
+// that aren't closed leave streaks along z behind their holes.
+void ObstacleVoxelizer::voxelize(Entry& entry) const
+{
+    SurfacePod mask = entry.Mask;
+    glm::vec3 size(mask.Width, mask.Height, mask.Depth);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mask.FboHandle);
+    glViewport(0, 0, mask.Width, mask.Height);
+    const GLuint zero[4] = { 0, 0, 0, 0 };
+    glClearBufferuiv(GL_COLOR, 0, zero);
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    glEnable(GL_COLOR_LOGIC_OP);
+    glLogicOp(GL_XOR);
+
+    glUseProgram(voxelizeProgram);
+    SetUniform(voxelizeProgram, "VoxelFromObject", glm::scale(glm::mat4(), size) * volumeTransform * entry.Current);
+    SetUniform(voxelizeProgram, "Size", size);
+    entry.Source->renderInstanced(mask.Depth);
+
+    glDisable(GL_COLOR_LOGIC_OP);
+    glBindVertexArray(0);
+    ResetState();
+
+    entry.Voxelized = entry.Current;
+}
+
+void ObstacleVoxelizer::composite(SurfacePod walls, SurfacePod solid, SurfacePod velocity, float timeStep) const
+{
+    GLuint pid = compositeProgram;
+    glUseProgram(pid);
+    SetUniform(pid, "Walls", 0);
+    SetUniform(pid, "InverseTimeStep", 1.0f / timeStep);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, walls.ColorTexture);
+
+    // Masks take the units after the walls, in the order they were added
+    int count = 0;
+    for (auto& entry : entries)
+    {
+        if (!entry.Enabled || !entry.Mask.ColorTexture)
+        {
+            continue;
+        }
+
+        std::string index = "[" + std::to_string(count) + "]";
+        glm::mat4 previousFromCurrent = volumeTransform * entry.Previous * glm::inverse(entry.Current) * glm::inverse(volumeTransform);
+        SetUniform(pid, ("Masks" + index).c_str(), count + 1);
+        SetUniform(pid, ("PreviousFromCurrent" + index).c_str(), previousFromCurrent);
+
+        glActiveTexture(GL_TEXTURE1 + count);
+        glBindTexture(GL_TEXTURE_3D, entry.Mask.ColorTexture);
+        ++count;
+    }
+    SetUniform(pid, "MaskCount", count);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, compositeFbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, solid.ColorTexture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, velocity.ColorTexture, 0);
+    const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(velocity.ColorTexture ? 2 : 1, buffers);
+
+    glViewport(0, 0, solid.Width, solid.Height);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, solid.Depth);
+
+    for (int i = count; i > 0; --i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+    ResetState();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "object.h"
+#include "utility.h"
+
+// Turns scene meshes into solver obstacles. Each enabled object is rasterized
+// into its own inside/outside mask, which is only redrawn when the object's
+// model matrix changes. The masks are then merged with the static walls into
+// a solid volume and an obstacle velocity volume, so moving objects push the
+// smoke around instead of just carving holes in it.
+class ObstacleVoxelizer
+{
+public:
+    static const int MaxObjects = 8;
+
+    void initialize();
+    void destroy();
+
+    void add(Object* object);
+    size_t size() const { return entries.size(); }
+    bool enabled(size_t index) const { return entries[index].Enabled; }
+    void setEnabled(size_t index, bool value);
+
+    // Forces the next update() to rebuild the composite, for when the volumes
+    // it writes into were reallocated
+    void invalidate() { dirty = true; }
+
+    // Redraws the masks of objects that moved, at the given (density) grid
+    // size. Returns true when the composite has to be rebuilt, which includes
+    // the step after an object stops so its velocity drops back to zero.
+    bool update(const glm::mat4& worldToVolume, GLsizei width, GLsizei height, GLsizei depth);
+
+    // Whether any enabled object moved in the last update()
+    bool moving() const;
+
+    // Writes the walls plus every enabled mask into solid. Velocity is only
+    // written when it has a texture; otherwise pass an empty SurfacePod.
+    void composite(SurfacePod walls, SurfacePod solid, SurfacePod velocity, float timeStep) const;
+
+private:
+    struct Entry {
+        Object* Source;
+        bool Enabled;
+        bool Moving;
+        SurfacePod Mask;
+        glm::mat4 Voxelized;    // model matrix the mask was drawn with
+        glm::mat4 Current;
+        glm::mat4 Previous;     // model matrix one update ago, for the velocity
+    };
+
+    void voxelize(Entry& entry) const;
+
+    std::vector<Entry> entries;
+    glm::mat4 volumeTransform;  // world to [0,1] volume coordinates
+    bool dirty = false;
+
+    GLuint voxelizeProgram = 0;
+    GLuint compositeProgram = 0;
+    GLuint compositeFbo = 0;
+};